@@ -15,6 +15,7 @@
 #include <BNO055.h> 
 #include <timers.h>
 #include <Board.h>
+#include <nvm.h>
 
 
 /*  MODULE-LEVEL DEFINITIONS, MACROS    */
@@ -241,104 +242,417 @@ static enum
 } BNO055_opmode;
 
 
+/** Initialization steps advanced by BNO055_InitService() **/
+static enum
+{
+    INIT_IDLE,
+    INIT_RESET,
+    INIT_CHECK_ID,
+    INIT_CONFIGURE,
+    INIT_SET_MODE,
+    INIT_SETTLE,
+    INIT_READY,
+    INIT_FAILED
+} initState = INIT_IDLE;
+
+static uint8_t opMode = OPERATION_MODE_AMG;   // mode entered at the end of init
+static uint32_t initStart;  // [us] time BNO055_InitStart() was called
+static uint32_t initStamp;  // [us] time the current step was entered
+static uint32_t initWait;   // [us] time the current step must wait before running
+static uint32_t initTime;   // [ms] duration of the whole initialization
+static uint8_t calibration[BNO055_CALIB_LENGTH];  // offset and radius registers
+static uint8_t calibRestored = FALSE;
+static uint8_t intEvents = 0;   // events routed to the INT pin
+static volatile uint8_t intPending = FALSE;
+static I2C_Script_t initScript;
+
+/**
+ * Configuration applied after reset. The interrupt settings on page 1
+ * (0x11 - 0x16) are consecutive registers and go out as one burst.
+ */
+static const I2C_ScriptOp configScript[] = {
+    /**
+     * Default state is in CONFIG_MODE. This is the only mode in which all the 
+     * writable register map entries can be changed. (Exceptions from this rule
+     * are the interrupt registers (INT and INT_MSK) and the operation mode
+     * register (OPR_MODE), which can be modified in any operation mode.)
+     */
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_OPR_MODE_ADDR, OPERATION_MODE_CONFIG),
+    // Delay between changing op modes > 19 msec.
+    I2C_SCRIPT_DELAY(25),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_PWR_MODE_ADDR, POWER_MODE_NORMAL),
+    // Page 1: accelerometer to +/- 2g, gyro for 1000 dps.
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_PAGE_ID_ADDR, BNO055_PAGE1),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_CONFIG, ACC_CONFIG_PARAMS),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_GYR_CONFIG_0, GYRO_CONFIG_PARAMS_0),
+    // Motion and high-g interrupt thresholds; events are enabled separately.
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_AM_THRES, ACC_AM_THRES_PARAM),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_INT_SETTINGS, ACC_INT_SETTINGS_PARAM),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_HG_DURATION, ACC_HG_DURATION_PARAM),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_HG_THRES, ACC_HG_THRES_PARAM),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_NM_THRES, ACC_NM_THRES_PARAM),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_ACC_NM_SET, ACC_NM_SET_PARAM),
+    I2C_SCRIPT_VERIFY(BNO055_ADDRESS_A, BNO055_GYR_CONFIG_0, GYRO_CONFIG_PARAMS_0),
+    // Page 0: units.
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_PAGE_ID_ADDR, BNO055_PAGE0),
+    I2C_SCRIPT_WRITE(BNO055_ADDRESS_A, BNO055_UNIT_SEL_ADDR, UNITS_PARAM),
+    I2C_SCRIPT_VERIFY(BNO055_ADDRESS_A, BNO055_UNIT_SEL_ADDR, UNITS_PARAM),
+    I2C_SCRIPT_DELAY(20),
+    I2C_SCRIPT_END
+};
+
+
 /*  PROTOTYPES  */
 void DelayMicros(uint32_t microsec);
+static int8_t BNO055_ReadVector(uint8_t reg, int16_t *vector, uint8_t axes);
+static int8_t BNO055_WriteInterruptMask(void);
 
 
 /*  FUNCTIONS   */
 /** BNO055_Init()
  *
- * Initializes the BNO055 for usage.
+ * Initializes the BNO055 for usage, blocking until the sensor is ready.
  * Sensors will be at:
  *  + Accel: 2g
- *  + Gyro: 250dps
+ *  + Gyro: 1000dps
  *
  * @return  (int8_t)    [SUCCESS, ERROR]
  */
 int8_t BNO055_Init(void)
+{
+    int8_t status;
+
+    if (BNO055_InitStart() != SUCCESS)
+    {
+        return ERROR;
+    }
+    while ((status = BNO055_InitService()) == FALSE);
+    return status;
+}
+
+/** BNO055_InitStart()
+ *
+ * Starts bringing up the BNO055 without blocking. BNO055_InitService() must
+ * then be called regularly until it reports SUCCESS or ERROR.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_InitStart(void)
 {
     BOARD_Init(); // Initialize board and printf functionality.
     TIMER_Init(); // Initialize timer module for delay functions.
     if (I2C_Init() != SUCCESS)
     {
         printf("I2C initialization error\r\n");
+        initState = INIT_FAILED;
         return ERROR;
     }
 
-    unsigned char byteReturn;
     // Delaying to ensure that successive programs do not glitch the sensor.
-    DelayMicros(1000000); 
-    
-    // Reset the device to allow for device reflashing without communication
-    // breakdowns (they're always the same )':).
-    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_SYS_TRIGGER_ADDR, 0x20);
-    DelayMicros(1000000); 
-
-    // Read chip ID to verify sensor connection.
-    byteReturn = I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_CHIP_ID_ADDR);
-    if (byteReturn != BNO055_ID)
+    initStart = TIMERS_GetMicroSeconds();
+    initStamp = initStart;
+    initWait = 1000000;
+    initState = INIT_RESET;
+    return SUCCESS;
+}
+
+/** BNO055_InitService()
+ *
+ * Advances the bring-up started by BNO055_InitStart() by at most one step;
+ * never waits on the sensor.
+ *
+ * @return  (int8_t)    FALSE while pending, then SUCCESS or ERROR.
+ */
+int8_t BNO055_InitService(void)
+{
+    uint32_t now = TIMERS_GetMicroSeconds();
+    int8_t status;
+
+    if (initState == INIT_READY)
+    {
+        return SUCCESS;
+    }
+    if (initState == INIT_IDLE || initState == INIT_FAILED)
     {
         return ERROR;
     }
+    if ((now - initStamp) < initWait)
+    {
+        return FALSE;
+    }
+    initStamp = now;
+    initWait = 0;
 
-    /**
-     * Default state is in CONFIG_MODE. This is the only mode in which all the 
-     * writable register map entries can be changed. (Exceptions from this rule
-     * are the interrupt registers (INT and INT_MSK) and the operation mode
-     * register (OPR_MODE), which can be modified in any operation mode.)
-     */
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_OPR_MODE_ADDR,
-        OPERATION_MODE_CONFIG
-    );
-    // Delay between changing op modes > 19 msec.
+    switch (initState)
+    {
+    case INIT_RESET:
+        // Reset the device to allow for device reflashing without communication
+        // breakdowns (they're always the same )':).
+        I2C_WriteReg(
+            BNO055_ADDRESS_A,
+            BNO055_SYS_TRIGGER_ADDR,
+            0x20
+        );
+        initWait = 650000; // Reset to CONFIG mode takes 650 msec.
+        initState = INIT_CHECK_ID;
+        break;
+
+    case INIT_CHECK_ID:
+        // Read chip ID to verify sensor connection; poll until it answers.
+        if (I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_CHIP_ID_ADDR) == BNO055_ID)
+        {
+            I2C_ScriptStart(&initScript, configScript);
+            initState = INIT_CONFIGURE;
+        }
+        else if ((now - initStart) > 3000000)
+        {
+            initState = INIT_FAILED;
+            return ERROR;
+        }
+        else
+        {
+            initWait = 10000;
+        }
+        break;
+
+    case INIT_CONFIGURE:
+        status = I2C_ScriptService(&initScript);
+        if (status == ERROR)
+        {
+            initState = INIT_FAILED;
+            return ERROR;
+        }
+        if (status == SUCCESS)
+        {
+            initState = INIT_SET_MODE;
+        }
+        break;
+
+    case INIT_SET_MODE:
+        // Restore the offsets of a previous calibration in one burst.
+        if (NVM_Read(calibration, BNO055_CALIB_LENGTH) == SUCCESS)
+        {
+            calibRestored = (I2C_WriteBytes(
+                BNO055_ADDRESS_A,
+                ACCEL_OFFSET_X_LSB_ADDR,
+                calibration,
+                BNO055_CALIB_LENGTH
+            ) == SUCCESS) ? TRUE : FALSE;
+        }
+        // Route the selected interrupt events to the INT pin.
+        if (intEvents != 0)
+        {
+            BNO055_WriteInterruptMask();
+        }
+        // Set operation mode (AMG unless a fusion mode was selected).
+        status = I2C_WriteReg(
+            BNO055_ADDRESS_A,
+            BNO055_OPR_MODE_ADDR,
+            opMode
+        );
+        if (status != SUCCESS)
+        {
+            initState = INIT_FAILED;
+            return ERROR;
+        }
+        initWait = 30000;
+        initState = INIT_SETTLE;
+        break;
+
+    case INIT_SETTLE:
+        initTime = (now - initStart) / 1000;
+        initState = INIT_READY;
+        return SUCCESS;
+
+    default:
+        break;
+    }
+    return FALSE;
+}
+
+/** BNO055_IsReady()
+ *
+ * @return  (int8_t)    TRUE once initialization has completed successfully.
+ */
+int8_t BNO055_IsReady(void)
+{
+    return (initState == INIT_READY) ? TRUE : FALSE;
+}
+
+/** BNO055_GetInitTime()
+ *
+ * @return  (uint32_t)  Milliseconds from BNO055_InitStart() until the sensor
+ *                      became ready, 0 while still pending.
+ */
+uint32_t BNO055_GetInitTime(void)
+{
+    return initTime;
+}
+
+/** BNO055_SetOperationMode(mode)
+ *
+ * Selects the operation mode. Called before BNO055_Init() it only chooses the
+ * mode the sensor is brought up in; afterwards it switches the running sensor
+ * through CONFIG mode (blocks for about 30 ms).
+ *
+ * @param   mode    (uint8_t)   [BNO055_MODE_AMG, BNO055_MODE_IMUPLUS, BNO055_MODE_NDOF]
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SetOperationMode(uint8_t mode)
+{
+    if (mode == OPERATION_MODE_CONFIG || mode > OPERATION_MODE_NDOF)
+    {
+        return ERROR;
+    }
+    opMode = mode;
+    if (initState != INIT_READY)
+    {
+        return SUCCESS;
+    }
+
+    // Any mode to CONFIG takes 7 msec, CONFIG to any mode takes 19 msec.
+    if (I2C_WriteReg(BNO055_ADDRESS_A, BNO055_OPR_MODE_ADDR, OPERATION_MODE_CONFIG) != SUCCESS)
+    {
+        return ERROR;
+    }
+    DelayMicros(10000);
+    if (I2C_WriteReg(BNO055_ADDRESS_A, BNO055_OPR_MODE_ADDR, opMode) != SUCCESS)
+    {
+        return ERROR;
+    }
+    DelayMicros(20000);
+    return SUCCESS;
+}
+
+/** BNO055_IsFusionMode()
+ *
+ * @return  (int8_t)    TRUE if the selected mode provides fused outputs.
+ */
+int8_t BNO055_IsFusionMode(void)
+{
+    return (opMode >= OPERATION_MODE_IMUPLUS) ? TRUE : FALSE;
+}
+
+/** BNO055_GetCalibStatus()
+ *
+ * Reads the calibration status: SYS<7:6> GYR<5:4> ACC<3:2> MAG<1:0>, each
+ * from 0 (uncalibrated) to 3 (fully calibrated). The chip only calibrates
+ * itself in the fusion modes.
+ *
+ * @return  (uint8_t)   CALIB_STAT register, 0 on a bus error.
+ */
+uint8_t BNO055_GetCalibStatus(void)
+{
+    return I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_CALIB_STAT_ADDR);
+}
+
+/** BNO055_IsCalibrated()
+ *
+ * @return  (int8_t)    TRUE when gyro and accelerometer report fully
+ *                      calibrated (the magnetometer is not used).
+ */
+int8_t BNO055_IsCalibrated(void)
+{
+    return ((BNO055_GetCalibStatus() & 0x3C) == 0x3C) ? TRUE : FALSE;
+}
+
+/** BNO055_IsCalibRestored()
+ *
+ * @return  (int8_t)    TRUE if stored offsets were written to the chip during
+ *                      initialization.
+ */
+int8_t BNO055_IsCalibRestored(void)
+{
+    return calibRestored;
+}
+
+/** BNO055_SaveCalibration()
+ *
+ * Captures the chip's current offset and radius registers (0x55 - 0x6A) and
+ * stores them in flash, to be restored by every following initialization.
+ * Blocks for the two mode changes and the flash erase (about a second).
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SaveCalibration(void)
+{
+    int8_t status;
+
+    if (initState != INIT_READY)
+    {
+        return ERROR;
+    }
+    // Offsets can only be read reliably in CONFIG mode.
+    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_OPR_MODE_ADDR, OPERATION_MODE_CONFIG);
     DelayMicros(25000);
-    byteReturn = I2C_WriteReg(
+    status = I2C_ReadBytes(
         BNO055_ADDRESS_A,
-        BNO055_PWR_MODE_ADDR,
-        POWER_MODE_NORMAL
+        ACCEL_OFFSET_X_LSB_ADDR,
+        calibration,
+        BNO055_CALIB_LENGTH
     );
-    // Set the register page to page 1.
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_PAGE_ID_ADDR,
-        BNO055_PAGE1
-    );
-    // Config gyro for 250 dps.
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_GYR_CONFIG_0,
-        GYRO_CONFIG_PARAMS_0
-    );
-    // Config accelerometer to +/- 2g.
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_ACC_CONFIG,
-        ACC_CONFIG_PARAMS
-    );
-    // Set the register page to page 0.
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_PAGE_ID_ADDR,
-        BNO055_PAGE0
-    );
-    // Set units.
+    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_OPR_MODE_ADDR, opMode);
     DelayMicros(20000);
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_UNIT_SEL_ADDR,
-        UNITS_PARAM
-    );
-    // Set operation mode to AMG.
-    byteReturn = I2C_WriteReg(
-        BNO055_ADDRESS_A,
-        BNO055_OPR_MODE_ADDR,
-        OPERATION_MODE_AMG
-    );
-    DelayMicros(30000);
-    return byteReturn;
 
+    if (status != SUCCESS)
+    {
+        return ERROR;
+    }
+    return NVM_Write(calibration, BNO055_CALIB_LENGTH);
+}
+
+/** BNO055_SetInterrupts(events)
+ *
+ * Selects the accelerometer events routed to the INT pin. Called before
+ * BNO055_InitStart() the thresholds and events are programmed during
+ * initialization; afterwards only the enabled events change. The INT pin is
+ * latched high until BNO055_InterruptService() resets it.
+ *
+ * @param   events  (uint8_t)   Any of BNO055_INT_NO_MOTION,
+ *                              BNO055_INT_ANY_MOTION, BNO055_INT_HIGH_G.
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SetInterrupts(uint8_t events)
+{
+    intEvents = events & (BNO055_INT_NO_MOTION | BNO055_INT_ANY_MOTION | BNO055_INT_HIGH_G);
+    if (initState != INIT_READY)
+    {
+        return SUCCESS;
+    }
+    return BNO055_WriteInterruptMask();
+}
+
+/** BNO055_IRQ()
+ *
+ * Call from the EXTI interrupt of the pin wired to INT; only marks the
+ * interrupt pending, the bus is not touched in interrupt context.
+ */
+void BNO055_IRQ(void)
+{
+    intPending = TRUE;
+}
+
+/** BNO055_InterruptService()
+ *
+ * If an interrupt is pending, reads and clears the interrupt status and
+ * releases the INT pin.
+ *
+ * @return  (uint8_t)   BNO055_INT_* events that fired, 0 if none.
+ */
+uint8_t BNO055_InterruptService(void)
+{
+    uint8_t events;
+
+    if (intPending == FALSE || initState != INIT_READY)
+    {
+        return 0;
+    }
+    intPending = FALSE;
+
+    // Reading INT_STA clears it; RST_INT releases the latched INT pin.
+    events = I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_INTR_STAT_ADDR);
+    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_SYS_TRIGGER_ADDR, 0x40);
+    return events & intEvents;
 }
 
 /** BNO055_ReadAccelX()
@@ -375,6 +689,58 @@ int BNO055_ReadAccelZ(void)
     return (I2C_ReadInt(BNO055_ADDRESS_A, BNO055_ACCEL_DATA_Z_LSB_ADDR, 0));
 }
 
+/** BNO055_ReadAccel(xyz)
+ *
+ * Burst-reads all three accelerometer axes in one I2C transaction so the
+ * returned frame is taken from a single sample.
+ *
+ * @param   xyz     (int16_t *)     Receives raw X, Y and Z readings.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadAccel(int16_t xyz[3])
+{
+    return BNO055_ReadVector(BNO055_ACCEL_DATA_X_LSB_ADDR, xyz, 3);
+}
+
+/** BNO055_ReadGyro(xyz)
+ *
+ * Burst-reads all three gyroscope axes in one I2C transaction.
+ * Rates are 16 LSB per degree per second.
+ *
+ * @param   xyz     (int16_t *)     Receives raw X, Y and Z readings.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadGyro(int16_t xyz[3])
+{
+    return BNO055_ReadVector(BNO055_GYRO_DATA_X_LSB_ADDR, xyz, 3);
+}
+
+/** BNO055_ReadMotion(accel, gyro)
+ *
+ * Burst-reads accelerometer and gyroscope in one I2C transaction (the
+ * magnetometer registers between them are read and dropped), so both come
+ * from the same sample.
+ *
+ * @param   accel   (int16_t *)     Receives raw accelerometer X, Y and Z.
+ * @param   gyro    (int16_t *)     Receives raw gyroscope X, Y and Z.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadMotion(int16_t accel[3], int16_t gyro[3])
+{
+    int16_t block[9];   // accel, mag, gyro
+
+    if (BNO055_ReadVector(BNO055_ACCEL_DATA_X_LSB_ADDR, block, 9) != SUCCESS)
+    {
+        return ERROR;
+    }
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        accel[i] = block[i];
+        gyro[i] = block[6 + i];
+    }
+    return SUCCESS;
+}
+
 /** BNO055_ReadGyroX()
  *
  * Reads sensor axis as given by name.
@@ -440,6 +806,44 @@ int BNO055_ReadMagZ(void)
     return (I2C_ReadInt(BNO055_ADDRESS_A, BNO055_MAG_DATA_Z_LSB_ADDR, 0));
 }
 
+/** BNO055_ReadGravity(xyz)
+ *
+ * Burst-reads the fused gravity vector (fusion modes only), 1 mg per LSB.
+ *
+ * @param   xyz     (int16_t *)     Receives X, Y and Z gravity.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadGravity(int16_t xyz[3])
+{
+    return BNO055_ReadVector(BNO055_GRAVITY_DATA_X_LSB_ADDR, xyz, 3);
+}
+
+/** BNO055_ReadLinearAccel(xyz)
+ *
+ * Burst-reads the fused linear acceleration, gravity removed (fusion modes
+ * only), 1 mg per LSB.
+ *
+ * @param   xyz     (int16_t *)     Receives X, Y and Z linear acceleration.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadLinearAccel(int16_t xyz[3])
+{
+    return BNO055_ReadVector(BNO055_LINEAR_ACCEL_DATA_X_LSB_ADDR, xyz, 3);
+}
+
+/** BNO055_ReadQuaternion(wxyz)
+ *
+ * Burst-reads the fused orientation quaternion (fusion modes only),
+ * 1.0 = 16384 LSB.
+ *
+ * @param   wxyz    (int16_t *)     Receives W, X, Y and Z.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadQuaternion(int16_t wxyz[4])
+{
+    return BNO055_ReadVector(BNO055_QUATERNION_DATA_W_LSB_ADDR, wxyz, 4);
+}
+
 /** BNO055_ReadTemp()
  *
  * @brief Reads sensor axis as given by name.
@@ -448,11 +852,54 @@ int BNO055_ReadMagZ(void)
  */
 int BNO055_ReadTemp(void)
 {
-    return (I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_TEMP_ADDR));
+    // Two's complement, 1 LSB = 1 C with the UNIT_SEL this driver programs.
+    return (int8_t)I2C_ReadRegister(BNO055_ADDRESS_A, BNO055_TEMP_ADDR);
 }
 
 
 /*  PRIVATE FUNCTIONS   */
+/** BNO055_WriteInterruptMask()
+ *
+ * Routes the selected events to the INT pin and enables them. INT_MSK and
+ * INT_EN are consecutive page 1 registers and may change in any mode.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+static int8_t BNO055_WriteInterruptMask(void)
+{
+    uint8_t mask[2] = {intEvents, intEvents};   // INT_MSK, INT_EN
+    int8_t status;
+
+    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_PAGE_ID_ADDR, BNO055_PAGE1);
+    status = I2C_WriteBytes(BNO055_ADDRESS_A, BNO055_INT_MSK, mask, 2);
+    I2C_WriteReg(BNO055_ADDRESS_A, BNO055_PAGE_ID_ADDR, BNO055_PAGE0);
+    return status;
+}
+
+/** BNO055_ReadVector(reg, vector, axes)
+ *
+ * Burst-reads consecutive little-endian 16-bit registers starting at reg.
+ *
+ * @param   reg     (uint8_t)       LSB address of the first axis.
+ * @param   vector  (int16_t *)     Receives one signed value per axis.
+ * @param   axes    (uint8_t)       Number of axes to read (at most 9).
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+static int8_t BNO055_ReadVector(uint8_t reg, int16_t *vector, uint8_t axes)
+{
+    uint8_t raw[18];
+
+    if (I2C_ReadBytes(BNO055_ADDRESS_A, reg, raw, axes * 2) != SUCCESS)
+    {
+        return ERROR;
+    }
+    for (uint8_t i = 0; i < axes; i++)
+    {
+        vector[i] = (int16_t)(raw[2 * i] | (raw[2 * i + 1] << 8));
+    }
+    return SUCCESS;
+}
+
 void DelayMicros(uint32_t microsec)
 {
     uint32_t curr_us = TIMERS_GetMicroSeconds();
@@ -28,25 +28,160 @@
 #define BNO055_PAGE1 1
 /** Sensor configuration values: 
  * ACC_PWR_Mode <2:0> ACC_BW <2:0> ACC_Range <1:0>
- * 64Hz [GYR_Config_0]: xx110xxxb | 250 dps [GYR_Config_0]: xxxxx011b
+ * 64Hz [GYR_Config_0]: xx110xxxb | 1000 dps [GYR_Config_0]: xxxxx001b
  **/
 #define ACC_CONFIG_PARAMS (0x18) // +/-2g, 62.5 Hz BW
-#define GYRO_CONFIG_PARAMS_0 (0x33)
+#define GYRO_CONFIG_PARAMS_0 (0x31) // 1000 dps so a quick flip does not saturate
 #define UNITS_PARAM (0x01)
+/** Accelerometer interrupt settings, for the +/-2g range of the non-fusion
+ * modes (the fusion modes run the accelerometer at +/-4g, doubling each step).
+ **/
+#define ACC_AM_THRES_PARAM (20)     // any-motion slope: 20 x 3.91 mg = 78 mg
+#define ACC_NM_THRES_PARAM (10)     // no-motion slope: 10 x 3.91 mg = 39 mg
+#define ACC_NM_SET_PARAM (0x09)     // no-motion (not slow-motion) held for 5 s
+#define ACC_HG_THRES_PARAM (192)    // high-g: 192 x 7.81 mg = 1.5 g
+#define ACC_HG_DURATION_PARAM (7)   // high-g held for (7 + 1) x 2 ms = 16 ms
+#define ACC_INT_SETTINGS_PARAM (0xFE) // high-g and motion on X, Y, Z; any-motion over 3 samples
+/** Interrupt events for BNO055_SetInterrupts() and BNO055_InterruptService(),
+ * matching the INT_STA, INT_MSK and INT_EN bit layout.
+ **/
+#define BNO055_INT_NO_MOTION (0x80)
+#define BNO055_INT_ANY_MOTION (0x40)
+#define BNO055_INT_HIGH_G (0x20)
+/** Operation modes for BNO055_SetOperationMode(). In the fusion modes the chip
+ * fuses the sensors itself and provides gravity, linear acceleration and
+ * quaternion outputs; sensor ranges are then chosen by the chip.
+ **/
+#define BNO055_MODE_AMG (0x07)      // raw accel, mag and gyro, no fusion (default)
+#define BNO055_MODE_IMUPLUS (0x08)  // accel + gyro fusion, relative orientation
+#define BNO055_MODE_NDOF (0x0C)     // accel + gyro + mag fusion, absolute orientation
+/** Bytes of offset and radius registers saved by BNO055_SaveCalibration(). **/
+#define BNO055_CALIB_LENGTH (22)
 
 
 /*  PROTOTYPES  */
 /** BNO055_Init()
  *
- * Initializes the BNO055 for usage.
+ * Initializes the BNO055 for usage, blocking until the sensor is ready.
  * Sensors will be at:
  *  + Accel: 2g
- *  + Gyro: 250dps
+ *  + Gyro: 1000dps
  *
  * @return  (int8_t)    [SUCCESS, ERROR]
  */
 int8_t BNO055_Init(void);
 
+/** BNO055_InitStart()
+ *
+ * Starts bringing up the BNO055 without blocking. BNO055_InitService() must
+ * then be called regularly until it reports SUCCESS or ERROR.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_InitStart(void);
+
+/** BNO055_InitService()
+ *
+ * Advances the bring-up started by BNO055_InitStart() by at most one step;
+ * never waits on the sensor.
+ *
+ * @return  (int8_t)    FALSE while pending, then SUCCESS or ERROR.
+ */
+int8_t BNO055_InitService(void);
+
+/** BNO055_IsReady()
+ *
+ * @return  (int8_t)    TRUE once initialization has completed successfully.
+ */
+int8_t BNO055_IsReady(void);
+
+/** BNO055_GetInitTime()
+ *
+ * @return  (uint32_t)  Milliseconds from BNO055_InitStart() until the sensor
+ *                      became ready, 0 while still pending.
+ */
+uint32_t BNO055_GetInitTime(void);
+
+/** BNO055_SetOperationMode(mode)
+ *
+ * Selects the operation mode. Called before BNO055_Init() it only chooses the
+ * mode the sensor is brought up in; afterwards it switches the running sensor
+ * through CONFIG mode (blocks for about 30 ms).
+ *
+ * @param   mode    (uint8_t)   [BNO055_MODE_AMG, BNO055_MODE_IMUPLUS, BNO055_MODE_NDOF]
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SetOperationMode(uint8_t mode);
+
+/** BNO055_IsFusionMode()
+ *
+ * @return  (int8_t)    TRUE if the selected mode provides fused outputs.
+ */
+int8_t BNO055_IsFusionMode(void);
+
+/** BNO055_SetInterrupts(events)
+ *
+ * Selects the accelerometer events routed to the INT pin. Called before
+ * BNO055_InitStart() the thresholds and events are programmed during
+ * initialization; afterwards only the enabled events change. The INT pin is
+ * latched high until BNO055_InterruptService() resets it.
+ *
+ * @param   events  (uint8_t)   Any of BNO055_INT_NO_MOTION,
+ *                              BNO055_INT_ANY_MOTION, BNO055_INT_HIGH_G.
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SetInterrupts(uint8_t events);
+
+/** BNO055_IRQ()
+ *
+ * Call from the EXTI interrupt of the pin wired to INT; only marks the
+ * interrupt pending, the bus is not touched in interrupt context.
+ */
+void BNO055_IRQ(void);
+
+/** BNO055_InterruptService()
+ *
+ * If an interrupt is pending, reads and clears the interrupt status and
+ * releases the INT pin.
+ *
+ * @return  (uint8_t)   BNO055_INT_* events that fired, 0 if none.
+ */
+uint8_t BNO055_InterruptService(void);
+
+/** BNO055_GetCalibStatus()
+ *
+ * Reads the calibration status: SYS<7:6> GYR<5:4> ACC<3:2> MAG<1:0>, each
+ * from 0 (uncalibrated) to 3 (fully calibrated). The chip only calibrates
+ * itself in the fusion modes.
+ *
+ * @return  (uint8_t)   CALIB_STAT register, 0 on a bus error.
+ */
+uint8_t BNO055_GetCalibStatus(void);
+
+/** BNO055_IsCalibrated()
+ *
+ * @return  (int8_t)    TRUE when gyro and accelerometer report fully
+ *                      calibrated (the magnetometer is not used).
+ */
+int8_t BNO055_IsCalibrated(void);
+
+/** BNO055_IsCalibRestored()
+ *
+ * @return  (int8_t)    TRUE if stored offsets were written to the chip during
+ *                      initialization.
+ */
+int8_t BNO055_IsCalibRestored(void);
+
+/** BNO055_SaveCalibration()
+ *
+ * Captures the chip's current offset and radius registers (0x55 - 0x6A) and
+ * stores them in flash, to be restored by every following initialization.
+ * Blocks for the two mode changes and the flash erase (about a second).
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t BNO055_SaveCalibration(void);
+
 /** BNO055_ReadAccelX()
  *
  * Reads sensor axis as given by name.
@@ -72,6 +207,38 @@ int BNO055_ReadAccelY(void);
  */
 int BNO055_ReadAccelZ(void);
 
+/** BNO055_ReadAccel(xyz)
+ *
+ * Burst-reads all three accelerometer axes in one I2C transaction so the
+ * returned frame is taken from a single sample.
+ *
+ * @param   xyz     (int16_t *)     Receives raw X, Y and Z readings.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadAccel(int16_t xyz[3]);
+
+/** BNO055_ReadGyro(xyz)
+ *
+ * Burst-reads all three gyroscope axes in one I2C transaction.
+ * Rates are 16 LSB per degree per second.
+ *
+ * @param   xyz     (int16_t *)     Receives raw X, Y and Z readings.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadGyro(int16_t xyz[3]);
+
+/** BNO055_ReadMotion(accel, gyro)
+ *
+ * Burst-reads accelerometer and gyroscope in one I2C transaction (the
+ * magnetometer registers between them are read and dropped), so both come
+ * from the same sample.
+ *
+ * @param   accel   (int16_t *)     Receives raw accelerometer X, Y and Z.
+ * @param   gyro    (int16_t *)     Receives raw gyroscope X, Y and Z.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadMotion(int16_t accel[3], int16_t gyro[3]);
+
 /** BNO055_ReadGyroX()
  *
  * Reads sensor axis as given by name.
@@ -120,11 +287,40 @@ int BNO055_ReadMagY(void);
  */
 int BNO055_ReadMagZ(void);
 
+/** BNO055_ReadGravity(xyz)
+ *
+ * Burst-reads the fused gravity vector (fusion modes only), 1 mg per LSB.
+ *
+ * @param   xyz     (int16_t *)     Receives X, Y and Z gravity.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadGravity(int16_t xyz[3]);
+
+/** BNO055_ReadLinearAccel(xyz)
+ *
+ * Burst-reads the fused linear acceleration, gravity removed (fusion modes
+ * only), 1 mg per LSB.
+ *
+ * @param   xyz     (int16_t *)     Receives X, Y and Z linear acceleration.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadLinearAccel(int16_t xyz[3]);
+
+/** BNO055_ReadQuaternion(wxyz)
+ *
+ * Burst-reads the fused orientation quaternion (fusion modes only),
+ * 1.0 = 16384 LSB.
+ *
+ * @param   wxyz    (int16_t *)     Receives W, X, Y and Z.
+ * @return          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t BNO055_ReadQuaternion(int16_t wxyz[4]);
+
 /** BNO055_ReadTemp()
  *
- * @brief Reads sensor axis as given by name.
+ * @brief Reads the chip temperature.
  *
- * @return  (int)   Returns raw sensor reading as an int.
+ * @return  (int)   Temperature in degrees Celsius.
  */
 int BNO055_ReadTemp(void);
 
@@ -11,6 +11,7 @@
 #include "stm32f4xx_hal.h"
 #include "stm32f4xx_hal_i2c.h"
 #include "I2C.h"
+#include "timers.h"
 
 
 /*  MODULE-LEVEL DEFINITIONS, MACROS    */
@@ -28,9 +29,40 @@
 #define SUCCESS ((int8_t) 1)
 #endif  /*  SUCCESS */
 
+#define I2C_RETRIES 1       // attempts repeated after a bus recovery
+// A byte takes about 0.1 ms at 100 kHz; allow twice that plus a margin for
+// clock stretching and the 1 ms granularity of the HAL tick.
+#define I2C_TIMEOUT_MS(length) (3 + ((length) + 2) / 5)
+
+// Bus time of a transfer of length bytes plus address and register bytes,
+// at 9 clocks per byte and 100 kHz.
+#define I2C_TRANSFER_US(length) (((length) + 2) * 90)
+#define I2C_BULK_MAX_WAIT_US 50000  // bulk goes ahead anyway after this long
+#define I2C_SCRIPT_BURST 16         // most script operations coalesced into one transfer
+
 I2C_HandleTypeDef hi2c2;
 
 static uint8_t initStatus = FALSE;
+static I2C_Stats_t stats[I2C_MAX_DEVICES];
+
+// Arbitration: the next announced real-time transfer and the waits per class.
+static uint32_t realtimeDue;
+static uint8_t realtimeAnnounced = FALSE;
+static uint32_t bulkWaitSince;
+static uint8_t bulkWaiting = FALSE;
+static uint32_t maxWait[I2C_CLASSES];
+
+
+/*  PROTOTYPES  */
+static int8_t I2C_Transfer(
+    unsigned char I2CAddress,
+    unsigned char deviceRegisterAddress,
+    uint8_t *data,
+    uint16_t length,
+    uint8_t isRead
+);
+static I2C_Stats_t *I2C_Device(unsigned char I2CAddress);
+static void I2C_HalfClock(void);
 
 
 /*  FUNCTIONS   */
@@ -77,27 +109,15 @@ unsigned char I2C_ReadRegister(
     unsigned char deviceRegisterAddress
 )
 {
-    HAL_StatusTypeDef ret;
-    I2CAddress = I2CAddress << 1; // use 8-bit address
-    uint8_t* data = &deviceRegisterAddress;
+    uint8_t data;
 
-    // Start condition; wait for it to end, this is internal and cannot stall.
-    ret = HAL_I2C_Master_Transmit(&hi2c2, I2CAddress, data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
-    {
-        printf("I2C Tx Error on read start condition\r\n");
-        return 0;
-    }
-
-    // Get byte; wait for it to end, this is internal and cannot stall.
-    ret = HAL_I2C_Master_Receive(&hi2c2, I2CAddress, data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    if (I2C_Transfer(I2CAddress, deviceRegisterAddress, &data, 1, TRUE) != SUCCESS)
     {
         printf("I2C Rx Error on read byte\r\n");
         return 0;
     }
 
-    return *data;
+    return data;
 }
 
 /** I2C_WriteReg(I2CAddress, deviceRegisterAddress, data)
@@ -118,19 +138,7 @@ unsigned char I2C_WriteReg(
     uint8_t data
 )
 {
-    HAL_StatusTypeDef ret;
-    I2CAddress = I2CAddress << 1; // Use 8-bit address.
-
-    ret = HAL_I2C_Mem_Write(
-        &hi2c2,
-        I2CAddress,
-        deviceRegisterAddress,
-        I2C_MEMADD_SIZE_8BIT,
-        &data,
-        1,
-        HAL_MAX_DELAY
-    );
-    if (ret != HAL_OK)
+    if (I2C_Transfer(I2CAddress, deviceRegisterAddress, &data, 1, FALSE) != SUCCESS)
     {
         printf("I2C Tx Error on write data\r\n");
         return ERROR;
@@ -179,3 +187,518 @@ int I2C_ReadInt(
     }
     return data;
 }
+
+/** I2C_ReadBytes(I2CAddress, deviceRegisterAddress, data, length)
+ *
+ * Reads a block of sequential registers in a single bus transaction, relying on
+ * the device's register auto-increment.
+ *
+ * @param   I2CAddress              (unsigned char) 7-bit address of I2C device
+ *                                                  wished to interact with.
+ * @param   deviceRegisterAddress   (unsigned char) 8-bit address of the first
+ *                                                  register on device.
+ * @param   data                    (uint8_t *)     Buffer receiving length bytes.
+ * @param   length                  (uint16_t)      Number of registers to read.
+ * @return                          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t I2C_ReadBytes(
+    unsigned char I2CAddress,
+    unsigned char deviceRegisterAddress,
+    uint8_t *data,
+    uint16_t length
+)
+{
+    if (I2C_Transfer(I2CAddress, deviceRegisterAddress, data, length, TRUE) != SUCCESS)
+    {
+        printf("I2C Rx Error on block read\r\n");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/** I2C_WriteBytes(I2CAddress, deviceRegisterAddress, data, length)
+ *
+ * Writes a block of sequential registers in a single bus transaction, relying
+ * on the device's register auto-increment.
+ *
+ * @param   I2CAddress              (unsigned char)     7-bit address of I2C
+ *                                                      device wished to
+ *                                                      interact with.
+ * @param   deviceRegisterAddress   (unsigned char)     8-bit address of the
+ *                                                      first register on device.
+ * @param   data                    (const uint8_t *)   length bytes to write.
+ * @param   length                  (uint16_t)          Number of registers to
+ *                                                      write.
+ * @return                          (int8_t)            [SUCCESS, ERROR]
+ */
+int8_t I2C_WriteBytes(
+    unsigned char I2CAddress,
+    unsigned char deviceRegisterAddress,
+    const uint8_t *data,
+    uint16_t length
+)
+{
+    if (I2C_Transfer(I2CAddress, deviceRegisterAddress, (uint8_t *)data, length, FALSE) != SUCCESS)
+    {
+        printf("I2C Tx Error on block write\r\n");
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/** I2C_Recover()
+ *
+ * Frees a bus held low by a slave that was interrupted mid-transfer (e.g. by
+ * an MCU reset): clocks SCL by hand until SDA is released (at most 9 clocks),
+ * issues a STOP and re-initializes the peripheral.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t I2C_Recover(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    uint8_t clock;
+
+    // Clear a BUSY flag the peripheral may hold, then release its pins.
+    hi2c2.Instance->CR1 |= I2C_CR1_SWRST;
+    hi2c2.Instance->CR1 &= ~I2C_CR1_SWRST;
+    HAL_I2C_DeInit(&hi2c2);
+    initStatus = FALSE;
+
+    // PB10 -> SCL, PB9 -> SDA as open-drain outputs, both released.
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10 | GPIO_PIN_9, GPIO_PIN_SET);
+    GPIO_InitStruct.Pin = GPIO_PIN_10 | GPIO_PIN_9;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+    I2C_HalfClock();
+
+    // Clock out the rest of whatever byte the slave is sending.
+    for (clock = 0; clock < 9 && HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_9) == GPIO_PIN_RESET; clock++)
+    {
+        HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_RESET);
+        I2C_HalfClock();
+        HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_SET);
+        I2C_HalfClock();
+    }
+
+    // STOP condition: SDA rises while SCL is high.
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_RESET);
+    I2C_HalfClock();
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_9, GPIO_PIN_RESET);
+    I2C_HalfClock();
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_10, GPIO_PIN_SET);
+    I2C_HalfClock();
+    HAL_GPIO_WritePin(GPIOB, GPIO_PIN_9, GPIO_PIN_SET);
+    I2C_HalfClock();
+
+    if (HAL_GPIO_ReadPin(GPIOB, GPIO_PIN_9) == GPIO_PIN_RESET)
+    {
+        printf("I2C bus still held low\r\n");
+    }
+    // The MSP init hands the pins back to the peripheral.
+    return I2C_Init();
+}
+
+/** I2C_GetStats(I2CAddress, deviceStats)
+ *
+ * Copies the transfer statistics of one device.
+ *
+ * @param   I2CAddress      (unsigned char)     7-bit address of I2C device.
+ * @param   deviceStats     (I2C_Stats_t *)     Receives the statistics.
+ * @return                  (int8_t)            [SUCCESS, ERROR] ERROR if the
+ *                                              device was never addressed.
+ */
+int8_t I2C_GetStats(unsigned char I2CAddress, I2C_Stats_t *deviceStats)
+{
+    uint8_t i;
+
+    for (i = 0; i < I2C_MAX_DEVICES; i++)
+    {
+        if (stats[i].address == I2CAddress)
+        {
+            *deviceStats = stats[i];
+            return SUCCESS;
+        }
+    }
+    return ERROR;
+}
+
+
+/** I2C_Announce(dueMicros)
+ *
+ * Tells the arbiter when the next real-time transfer is due, so bulk
+ * transfers that would still occupy the bus at that time are held back.
+ *
+ * @param   dueMicros   (uint32_t)  TIMERS_GetMicroSeconds() time it is due.
+ */
+void I2C_Announce(uint32_t dueMicros)
+{
+    realtimeDue = dueMicros;
+    realtimeAnnounced = TRUE;
+}
+
+/** I2C_Claim(busClass, length)
+ *
+ * Asks whether a transfer of the given class may start now. Real-time
+ * transfers always may. A bulk transfer may if it ends before the next
+ * announced real-time transfer is due, or once it has waited 50 ms. Bulk
+ * clients split their work into chunks and claim the bus for each one.
+ *
+ * @param   busClass    (uint8_t)   [I2C_CLASS_REALTIME, I2C_CLASS_BULK]
+ * @param   length      (uint16_t)  Data bytes of the transfer.
+ * @return              (int8_t)    [TRUE, FALSE]
+ */
+int8_t I2C_Claim(uint8_t busClass, uint16_t length)
+{
+    uint32_t now = TIMERS_GetMicroSeconds();
+    uint32_t wait = 0;
+
+    if (busClass == I2C_CLASS_REALTIME)
+    {
+        // Waited from the announced due time, e.g. behind a bulk transfer.
+        if (realtimeAnnounced && (int32_t)(now - realtimeDue) > 0)
+        {
+            wait = now - realtimeDue;
+        }
+        realtimeAnnounced = FALSE;
+    }
+    else
+    {
+        if (bulkWaiting == FALSE)
+        {
+            bulkWaiting = TRUE;
+            bulkWaitSince = now;
+        }
+        if (realtimeAnnounced &&
+            (int32_t)(realtimeDue - now) < (int32_t)I2C_TRANSFER_US(length) &&
+            now - bulkWaitSince < I2C_BULK_MAX_WAIT_US)
+        {
+            return FALSE;
+        }
+        bulkWaiting = FALSE;
+        wait = now - bulkWaitSince;
+        busClass = I2C_CLASS_BULK;
+    }
+
+    if (wait > maxWait[busClass])
+    {
+        maxWait[busClass] = wait;
+    }
+    return TRUE;
+}
+
+/** I2C_GetMaxWait(busClass)
+ *
+ * @param   busClass    (uint8_t)   [I2C_CLASS_REALTIME, I2C_CLASS_BULK]
+ * @return              (uint32_t)  Longest wait in usec a claim of the class
+ *                                  has seen: real-time past its announced due
+ *                                  time, bulk from its first refused claim.
+ */
+uint32_t I2C_GetMaxWait(uint8_t busClass)
+{
+    return (busClass < I2C_CLASSES) ? maxWait[busClass] : 0;
+}
+
+/** I2C_ScriptStart(script, ops)
+ *
+ * Starts running an init script; I2C_ScriptService() then advances it.
+ * Consecutive writes to consecutive registers of one device go out as one
+ * burst, consecutive commands to one device with the same control byte as one
+ * command stream.
+ *
+ * @param   script  (I2C_Script_t *)        Progress, owned by the caller.
+ * @param   ops     (const I2C_ScriptOp *)  Script ending with I2C_SCRIPT_END.
+ */
+void I2C_ScriptStart(I2C_Script_t *script, const I2C_ScriptOp *ops)
+{
+    script->ops = ops;
+    script->next = 0;
+    script->wait = 0;
+}
+
+/** I2C_ScriptService(script)
+ *
+ * Makes at most one transfer of a running script; never waits on a delay.
+ *
+ * @param   script  (I2C_Script_t *)    Progress of the script.
+ * @return          (int8_t)            FALSE while running, then SUCCESS, or
+ *                                      ERROR on a failed transfer or check.
+ */
+int8_t I2C_ScriptService(I2C_Script_t *script)
+{
+    const I2C_ScriptOp *op = &script->ops[script->next];
+    uint8_t burst[I2C_SCRIPT_BURST];
+    uint8_t length = 0;
+    int8_t status = SUCCESS;
+
+    if (script->wait != 0)
+    {
+        if (TIMERS_GetMicroSeconds() - script->waitStart < script->wait)
+        {
+            return FALSE;
+        }
+        script->wait = 0;
+    }
+
+    switch (op->op)
+    {
+    case I2C_OP_END:
+        return SUCCESS;
+
+    case I2C_OP_DELAY:
+        script->waitStart = TIMERS_GetMicroSeconds();
+        script->wait = op->value * 1000;
+        script->next++;
+        return FALSE;
+
+    case I2C_OP_VERIFY:
+        if (I2C_ReadBytes(op->address, op->reg, burst, 1) != SUCCESS || burst[0] != op->value)
+        {
+            printf("I2C verify failed at 0x%x:0x%x\r\n", op->address, op->reg);
+            return ERROR;
+        }
+        script->next++;
+        return FALSE;
+
+    case I2C_OP_WRITE:
+        // Gather writes continuing at the next register of the same device.
+        while (length < I2C_SCRIPT_BURST &&
+               op[length].op == I2C_OP_WRITE &&
+               op[length].address == op->address &&
+               op[length].reg == (uint8_t)(op->reg + length))
+        {
+            burst[length] = op[length].value;
+            length++;
+        }
+        status = I2C_WriteBytes(op->address, op->reg, burst, length);
+        break;
+
+    case I2C_OP_COMMAND:
+        // Gather commands to the same device into one stream.
+        while (length < I2C_SCRIPT_BURST &&
+               op[length].op == I2C_OP_COMMAND &&
+               op[length].address == op->address &&
+               op[length].reg == op->reg)
+        {
+            burst[length] = op[length].value;
+            length++;
+        }
+        status = I2C_WriteBytes(op->address, op->reg, burst, length);
+        break;
+
+    default:
+        return ERROR;
+    }
+
+    script->next += length;
+    return (status == SUCCESS) ? FALSE : ERROR;
+}
+
+/** I2C_ScriptRun(ops)
+ *
+ * Runs a whole init script, blocking through its delays.
+ *
+ * @param   ops     (const I2C_ScriptOp *)  Script ending with I2C_SCRIPT_END.
+ * @return          (int8_t)                [SUCCESS, ERROR]
+ */
+int8_t I2C_ScriptRun(const I2C_ScriptOp *ops)
+{
+    I2C_Script_t script;
+    int8_t status;
+
+    I2C_ScriptStart(&script, ops);
+    while ((status = I2C_ScriptService(&script)) == FALSE);
+    return status;
+}
+
+
+/*  PRIVATE FUNCTIONS   */
+/** I2C_Transfer(I2CAddress, deviceRegisterAddress, data, length, isRead)
+ *
+ * Reads or writes a block of registers with a timeout bounded by the length.
+ * A failure other than a plain NACK may have left the bus stuck, so the bus
+ * is recovered and the transfer retried.
+ */
+static int8_t I2C_Transfer(
+    unsigned char I2CAddress,
+    unsigned char deviceRegisterAddress,
+    uint8_t *data,
+    uint16_t length,
+    uint8_t isRead
+)
+{
+    I2C_Stats_t *device = I2C_Device(I2CAddress);
+    HAL_StatusTypeDef ret = HAL_ERROR;
+    uint8_t attempt;
+
+    // A recovery that could not re-initialize the peripheral is retried here.
+    if (initStatus == FALSE && I2C_Init() != SUCCESS)
+    {
+        device->errors++;
+        return ERROR;
+    }
+
+    for (attempt = 0; attempt <= I2C_RETRIES; attempt++)
+    {
+        if (attempt > 0)
+        {
+            device->retries++;
+        }
+        device->transfers++;
+        if (isRead)
+        {
+            ret = HAL_I2C_Mem_Read(
+                &hi2c2,
+                I2CAddress << 1, // Use 8-bit address.
+                deviceRegisterAddress,
+                I2C_MEMADD_SIZE_8BIT,
+                data,
+                length,
+                I2C_TIMEOUT_MS(length)
+            );
+        }
+        else
+        {
+            ret = HAL_I2C_Mem_Write(
+                &hi2c2,
+                I2CAddress << 1, // Use 8-bit address.
+                deviceRegisterAddress,
+                I2C_MEMADD_SIZE_8BIT,
+                data,
+                length,
+                I2C_TIMEOUT_MS(length)
+            );
+        }
+        if (ret == HAL_OK)
+        {
+            return SUCCESS;
+        }
+
+        device->errors++;
+        if (ret == HAL_ERROR && (hi2c2.ErrorCode & ~HAL_I2C_ERROR_AF) == 0)
+        {
+            // NACK: the device is absent or busy, the bus itself is fine.
+            return ERROR;
+        }
+        if (ret != HAL_ERROR)
+        {
+            device->timeouts++;
+        }
+        device->recoveries++;
+        I2C_Recover();
+    }
+    return ERROR;
+}
+
+/** I2C_Device(I2CAddress)
+ *
+ * Finds or claims the statistics entry of a device; once the table is full
+ * further devices are counted against the last entry.
+ */
+static I2C_Stats_t *I2C_Device(unsigned char I2CAddress)
+{
+    uint8_t i;
+
+    for (i = 0; i < I2C_MAX_DEVICES; i++)
+    {
+        if (stats[i].address == I2CAddress || stats[i].transfers == 0)
+        {
+            stats[i].address = I2CAddress;
+            return &stats[i];
+        }
+    }
+    return &stats[I2C_MAX_DEVICES - 1];
+}
+
+/** I2C_HalfClock()
+ *
+ * Busy-waits about 5 usec, half an SCL period at 100 kHz.
+ */
+static void I2C_HalfClock(void)
+{
+    for (volatile uint32_t n = SystemCoreClock / 800000; n > 0; n--);
+}
+
+
+/** I2C_ARBITER_TEST
+ *
+ * Uncomment the below "#define" to run the I2C_ARBITER_TEST. Needs the BNO055
+ * and the OLED on the bus.
+ *
+ * SUCCESS - With the OLED redrawn continuously, 100 Hz IMU reads start at most
+ * about one chunk (~1 ms) late with the chunked update, against a whole frame
+ * (~50 ms) with the blocking update. The test prints the worst lateness of each
+ * update and "PASS" if the chunked one stays within TEST_LATE_BOUND_US.
+ */
+//#define I2C_ARBITER_TEST
+#ifdef I2C_ARBITER_TEST
+#include <Board.h>
+#include <BNO055.h>
+#include <Oled.h>
+
+#define TEST_PERIOD_US 10000
+#define TEST_LATE_BOUND_US 2000               // one chunk (~1 ms) and the read itself
+
+static uint32_t RunPhase(uint8_t chunked)
+{
+    uint32_t start = TIMERS_GetMicroSeconds();
+    uint32_t due = start;
+    uint32_t now;
+    uint32_t worst = 0;
+    int16_t accel[3], gyro[3];
+
+    while ((now = TIMERS_GetMicroSeconds()) - start < 3000000)
+    {
+        if ((int32_t)(now - due) >= 0)
+        {
+            if (now - due > worst)
+            {
+                worst = now - due;
+            }
+            I2C_Claim(I2C_CLASS_REALTIME, 18);
+            BNO055_ReadMotion(accel, gyro);
+            due = (now - due > TEST_PERIOD_US) ? now + TEST_PERIOD_US : due + TEST_PERIOD_US;
+            I2C_Announce(due);
+        }
+        if (chunked)
+        {
+            if (OledUpdateService() == TRUE)
+            {
+                OledStartUpdate();
+            }
+        }
+        else
+        {
+            OledUpdate();
+        }
+    }
+    return worst;
+}
+
+int main(void)
+{
+    BOARD_Init();
+    BNO055_Init();
+    OledInit();
+    OledDrawString("I2C arbiter test\nOLED vs IMU");
+
+    uint32_t chunked = RunPhase(TRUE);
+    uint32_t realtimeWait = I2C_GetMaxWait(I2C_CLASS_REALTIME);
+    uint32_t bulkWait = I2C_GetMaxWait(I2C_CLASS_BULK);
+    uint32_t blocking = RunPhase(FALSE);
+
+    printf("chunked update:  IMU read up to %lu us late\r\n", (unsigned long)chunked);
+    printf(
+        "                 max wait: real-time %lu us, bulk %lu us\r\n",
+        (unsigned long)realtimeWait,
+        (unsigned long)bulkWait
+    );
+    printf("blocking update: IMU read up to %lu us late\r\n", (unsigned long)blocking);
+    printf("%s\r\n", (chunked <= TEST_LATE_BOUND_US && chunked < blocking) ? "PASS" : "FAIL");
+    while (TRUE);
+}
+#endif
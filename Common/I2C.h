@@ -8,6 +8,56 @@
 #ifndef I2C_H
 #define	I2C_H
 
+#include <stdint.h>
+
+#define I2C_MAX_DEVICES 4   // devices with their own I2C_Stats_t entry
+
+/** Arbitration classes for I2C_Claim(). **/
+#define I2C_CLASS_REALTIME 0    // short, deadline-paced reads (IMU)
+#define I2C_CLASS_BULK 1        // long transfers that may yield (OLED)
+#define I2C_CLASSES 2
+
+/** Transfer statistics of one device, see I2C_GetStats(). **/
+typedef struct
+{
+    uint8_t address;        // 7-bit device address
+    uint32_t transfers;     // attempts, including retries
+    uint32_t errors;        // failed attempts (NACK, bus error or timeout)
+    uint32_t timeouts;      // failed attempts that timed out or found the bus busy
+    uint32_t retries;       // attempts repeated after a recovery
+    uint32_t recoveries;    // bus clears performed
+} I2C_Stats_t;
+
+/** Init script operations, see I2C_ScriptStart(). **/
+#define I2C_OP_END 0        // end of the script
+#define I2C_OP_WRITE 1      // write value to register reg
+#define I2C_OP_COMMAND 2    // send command byte value after control byte reg
+#define I2C_OP_VERIFY 3     // read register reg back and expect value
+#define I2C_OP_DELAY 4      // wait value msec without blocking
+
+/** One step of an init script, typically kept in a const table in flash. **/
+typedef struct
+{
+    uint8_t op;         // I2C_OP_*
+    uint8_t address;    // 7-bit device address
+    uint8_t reg;        // register, or control byte of a command
+    uint8_t value;      // data, command byte, or delay in msec
+} I2C_ScriptOp;
+
+#define I2C_SCRIPT_WRITE(address, reg, value) {I2C_OP_WRITE, (address), (reg), (value)}
+#define I2C_SCRIPT_COMMAND(address, control, command) {I2C_OP_COMMAND, (address), (control), (command)}
+#define I2C_SCRIPT_VERIFY(address, reg, value) {I2C_OP_VERIFY, (address), (reg), (value)}
+#define I2C_SCRIPT_DELAY(msec) {I2C_OP_DELAY, 0, 0, (msec)}
+#define I2C_SCRIPT_END {I2C_OP_END, 0, 0, 0}
+
+/** Progress of one running script. **/
+typedef struct
+{
+    const I2C_ScriptOp *ops;
+    uint16_t next;          // index of the next operation
+    uint32_t waitStart;     // [usec] start of a running delay
+    uint32_t wait;          // [usec] length of a running delay
+} I2C_Script_t;
 
 /** I2C_Init()
  *
@@ -58,5 +108,123 @@ unsigned char I2C_WriteReg(unsigned char I2CAddress, unsigned char deviceRegiste
  */
 int I2C_ReadInt(char I2CAddress, char deviceRegisterAddress, char isBigEndian);
 
+/** I2C_ReadBytes(I2CAddress, deviceRegisterAddress, data, length)
+ *
+ * Reads a block of sequential registers in a single bus transaction, relying on
+ * the device's register auto-increment.
+ *
+ * @param   I2CAddress              (unsigned char) 7-bit address of I2C device
+ *                                                  wished to interact with.
+ * @param   deviceRegisterAddress   (unsigned char) 8-bit address of the first
+ *                                                  register on device.
+ * @param   data                    (uint8_t *)     Buffer receiving length bytes.
+ * @param   length                  (uint16_t)      Number of registers to read.
+ * @return                          (int8_t)        [SUCCESS, ERROR]
+ */
+int8_t I2C_ReadBytes(unsigned char I2CAddress, unsigned char deviceRegisterAddress, uint8_t *data, uint16_t length);
+
+/** I2C_WriteBytes(I2CAddress, deviceRegisterAddress, data, length)
+ *
+ * Writes a block of sequential registers in a single bus transaction, relying
+ * on the device's register auto-increment.
+ *
+ * @param   I2CAddress              (unsigned char)     7-bit address of I2C
+ *                                                      device wished to
+ *                                                      interact with.
+ * @param   deviceRegisterAddress   (unsigned char)     8-bit address of the
+ *                                                      first register on device.
+ * @param   data                    (const uint8_t *)   length bytes to write.
+ * @param   length                  (uint16_t)          Number of registers to
+ *                                                      write.
+ * @return                          (int8_t)            [SUCCESS, ERROR]
+ */
+int8_t I2C_WriteBytes(unsigned char I2CAddress, unsigned char deviceRegisterAddress, const uint8_t *data, uint16_t length);
+
+/** I2C_Recover()
+ *
+ * Frees a bus held low by a slave that was interrupted mid-transfer (e.g. by
+ * an MCU reset): clocks SCL by hand until SDA is released (at most 9 clocks),
+ * issues a STOP and re-initializes the peripheral. Transfers call this by
+ * themselves after a bus error or timeout.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t I2C_Recover(void);
+
+/** I2C_GetStats(I2CAddress, deviceStats)
+ *
+ * Copies the transfer statistics of one device. The first I2C_MAX_DEVICES
+ * devices addressed get their own entry; any further device is counted
+ * against the last of them.
+ *
+ * @param   I2CAddress      (unsigned char)     7-bit address of I2C device.
+ * @param   deviceStats     (I2C_Stats_t *)     Receives the statistics.
+ * @return                  (int8_t)            [SUCCESS, ERROR] ERROR if the
+ *                                              device was never addressed.
+ */
+int8_t I2C_GetStats(unsigned char I2CAddress, I2C_Stats_t *deviceStats);
+
+/** I2C_Announce(dueMicros)
+ *
+ * Tells the arbiter when the next real-time transfer is due, so bulk
+ * transfers that would still occupy the bus at that time are held back.
+ *
+ * @param   dueMicros   (uint32_t)  TIMERS_GetMicroSeconds() time it is due.
+ */
+void I2C_Announce(uint32_t dueMicros);
+
+/** I2C_Claim(busClass, length)
+ *
+ * Asks whether a transfer of the given class may start now. Real-time
+ * transfers always may. A bulk transfer may if it ends before the next
+ * announced real-time transfer is due, or once it has waited 50 ms. Bulk
+ * clients split their work into chunks and claim the bus for each one.
+ *
+ * @param   busClass    (uint8_t)   [I2C_CLASS_REALTIME, I2C_CLASS_BULK]
+ * @param   length      (uint16_t)  Data bytes of the transfer.
+ * @return              (int8_t)    [TRUE, FALSE]
+ */
+int8_t I2C_Claim(uint8_t busClass, uint16_t length);
+
+/** I2C_GetMaxWait(busClass)
+ *
+ * @param   busClass    (uint8_t)   [I2C_CLASS_REALTIME, I2C_CLASS_BULK]
+ * @return              (uint32_t)  Longest wait in usec a claim of the class
+ *                                  has seen: real-time past its announced due
+ *                                  time, bulk from its first refused claim.
+ */
+uint32_t I2C_GetMaxWait(uint8_t busClass);
+
+/** I2C_ScriptStart(script, ops)
+ *
+ * Starts running an init script; I2C_ScriptService() then advances it.
+ * Consecutive writes to consecutive registers of one device go out as one
+ * burst, consecutive commands to one device with the same control byte as one
+ * command stream.
+ *
+ * @param   script  (I2C_Script_t *)        Progress, owned by the caller.
+ * @param   ops     (const I2C_ScriptOp *)  Script ending with I2C_SCRIPT_END.
+ */
+void I2C_ScriptStart(I2C_Script_t *script, const I2C_ScriptOp *ops);
+
+/** I2C_ScriptService(script)
+ *
+ * Makes at most one transfer of a running script; never waits on a delay.
+ *
+ * @param   script  (I2C_Script_t *)    Progress of the script.
+ * @return          (int8_t)            FALSE while running, then SUCCESS, or
+ *                                      ERROR on a failed transfer or check.
+ */
+int8_t I2C_ScriptService(I2C_Script_t *script);
+
+/** I2C_ScriptRun(ops)
+ *
+ * Runs a whole init script, blocking through its delays.
+ *
+ * @param   ops     (const I2C_ScriptOp *)  Script ending with I2C_SCRIPT_END.
+ * @return          (int8_t)                [SUCCESS, ERROR]
+ */
+int8_t I2C_ScriptRun(const I2C_ScriptOp *ops);
+
 
 #endif
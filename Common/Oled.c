@@ -188,6 +188,16 @@ void OledUpdate(void)
     OledDriverUpdateDisplay();
 }
 
+void OledStartUpdate(void)
+{
+    OledDriverStartUpdate();
+}
+
+int OledUpdateService(void)
+{
+    return OledDriverUpdateService();
+}
+
 
 
 //#define OLED_TEST
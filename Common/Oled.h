@@ -151,4 +151,18 @@ void OledOff(void);
  */
 void OledUpdate(void);
 
+/**
+ * Non-blocking OledUpdate(): takes a snapshot of the screen and returns at once. The pixel data is
+ * then sent in small chunks by OledUpdateService(), which must be called regularly (e.g. every pass
+ * of the main loop). Chunks only go out when they will not delay a real-time I2C transfer such as
+ * the IMU read, see I2C_Claim().
+ */
+void OledStartUpdate(void);
+
+/**
+ * Send the next chunk of an update started by OledStartUpdate(), if the I2C bus is available.
+ * @return TRUE once the whole update has been sent.
+ */
+int OledUpdateService(void);
+
 #endif
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <Board.h>
 #include <I2C.h>
 #include <OledDriver.h>
@@ -55,6 +56,10 @@ typedef enum {
 
 #define OLED_DRIVER_PAGES 4
 
+// Data bytes per transfer of a chunked update; with the address and control bytes
+// about 0.9 ms of bus time, so a chunk fits in a 1 ms task slot.
+#define OLED_DRIVER_CHUNK 8
+
 /**
  * This array is the off-screen frame buffer used for rendering.
  * It isn't possible to read back from the OLED display device,
@@ -64,8 +69,14 @@ typedef enum {
  */
 uint8_t rgbOledBmp[OLED_DRIVER_BUFFER_SIZE];
 
+// Frame being sent by OledDriverUpdateService(), and its progress.
+static uint8_t updateBmp[OLED_DRIVER_BUFFER_SIZE];
+static int updatePage = OLED_DRIVER_PAGES;  // OLED_DRIVER_PAGES when idle
+static int updateColumn = 0;                // -1 until the page is selected
+
 // Function prototypes for private functions.
 void DelayMs(uint32_t ms);
+static void OledDriverSelectPage(int page);
 
 /**
  * Initialize the STM32 to communicate with the OLED display through the SSD1306
@@ -83,25 +94,31 @@ void OledHostInit(void)
  */
 void OledDriverInitDisplay(void)
 {
-    // Turn off the display.
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_DISPLAY_OFF);
-
-    // Enable the charge pump and
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_CHARGE_PUMP);
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_SETTING_ENABLE_CHARGE_PUMP);
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_PRECHARGE_PERIOD);
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_SETTING_MAXIMUM_PRECHARGE);
-
-    // Invert row numbering so that (0,0) is upper-right.
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_SEGMENT_REMAP);
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_SETTING_REVERSE_ROW_ORDERING);
-
-    // Set sequential COM configuration with non-interleaved memory.
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_COM_PINS_CONFIG);
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_SETTING_SEQUENTIAL_COM_NON_INTERLEAVED);
-
-    // And turn on the display.
-    I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_DISPLAY_ON);
+    // Sent as a single command stream.
+    static const I2C_ScriptOp oledInit[] = {
+        // Turn off the display.
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_DISPLAY_OFF),
+
+        // Enable the charge pump and
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_SET_CHARGE_PUMP),
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_SETTING_ENABLE_CHARGE_PUMP),
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_SET_PRECHARGE_PERIOD),
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_SETTING_MAXIMUM_PRECHARGE),
+
+        // Invert row numbering so that (0,0) is upper-right.
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_SET_SEGMENT_REMAP),
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_SETTING_REVERSE_ROW_ORDERING),
+
+        // Set sequential COM configuration with non-interleaved memory.
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_SET_COM_PINS_CONFIG),
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_SETTING_SEQUENTIAL_COM_NON_INTERLEAVED),
+
+        // And turn on the display.
+        I2C_SCRIPT_COMMAND(OLED_ADDRESS, COMMAND_STREAM, OLED_COMMAND_DISPLAY_ON),
+        I2C_SCRIPT_END
+    };
+
+    I2C_ScriptRun(oledInit);
 }
 
 /**
@@ -137,24 +154,82 @@ void OledDriverDisableDisplay(void)
  */
 void OledDriverUpdateDisplay(void)
 {
-    uint8_t *pb = rgbOledBmp;
     int page;
     for (page = 0; page < OLED_DRIVER_PAGES; page++) {
+        OledDriverSelectPage(page);
+
+        // Write this entire column to the OLED in one data stream.
+        I2C_WriteBytes(
+            OLED_ADDRESS,
+            DATA_STREAM,
+            &rgbOledBmp[page * OLED_DRIVER_PIXEL_COLUMNS],
+            OLED_DRIVER_PIXEL_COLUMNS
+        );
+    }
+}
 
-        // Set the desired page.
-        I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_PAGE);
-        I2C_WriteReg(OLED_ADDRESS, COMMAND, page);
+/**
+ * Start sending a snapshot of rgbOledBmp without blocking; the transfers are
+ * made by OledDriverUpdateService(). Restarts an update still in progress.
+ */
+void OledDriverStartUpdate(void)
+{
+    memcpy(updateBmp, rgbOledBmp, sizeof(updateBmp));
+    updatePage = 0;
+    updateColumn = -1;
+}
 
-        // Set the starting column back to the origin.
-        I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_DISPLAY_LOWER_COLUMN_0);
-        I2C_WriteReg(OLED_ADDRESS, COMMAND, OLED_COMMAND_SET_DISPLAY_UPPER_COLUMN_0);
+/**
+ * Make at most one transfer of the update started by OledDriverStartUpdate(),
+ * when the I2C arbiter grants the bus to bulk traffic.
+ * @return TRUE once no update is in progress.
+ */
+int OledDriverUpdateService(void)
+{
+    if (updatePage >= OLED_DRIVER_PAGES) {
+        return TRUE;
+    }
+
+    if (updateColumn < 0) {
+        if (I2C_Claim(I2C_CLASS_BULK, 4) == TRUE) {
+            OledDriverSelectPage(updatePage);
+            updateColumn = 0;
+        }
+        return FALSE;
+    }
 
-        // Write this entire column to the OLED.
-        for (int i = 0; i < OLED_DRIVER_PIXEL_COLUMNS; i++) {
-            I2C_WriteReg(OLED_ADDRESS, DATA, *pb);
-            pb++;
+    if (I2C_Claim(I2C_CLASS_BULK, OLED_DRIVER_CHUNK) == TRUE) {
+        // The column address advances by itself, so a page goes out in chunks.
+        I2C_WriteBytes(
+            OLED_ADDRESS,
+            DATA_STREAM,
+            &updateBmp[updatePage * OLED_DRIVER_PIXEL_COLUMNS + updateColumn],
+            OLED_DRIVER_CHUNK
+        );
+        updateColumn += OLED_DRIVER_CHUNK;
+        if (updateColumn >= OLED_DRIVER_PIXEL_COLUMNS) {
+            updatePage++;
+            updateColumn = -1;
         }
     }
+    return (updatePage >= OLED_DRIVER_PAGES) ? TRUE : FALSE;
+}
+
+/**
+ * Select the page to write and set the starting column back to the origin,
+ * in one command stream.
+ * @param page The page (8 pixel rows) to write next.
+ */
+static void OledDriverSelectPage(int page)
+{
+    uint8_t commands[] = {
+        OLED_COMMAND_SET_PAGE,
+        page,
+        OLED_COMMAND_SET_DISPLAY_LOWER_COLUMN_0,
+        OLED_COMMAND_SET_DISPLAY_UPPER_COLUMN_0
+    };
+
+    I2C_WriteBytes(OLED_ADDRESS, COMMAND_STREAM, commands, sizeof(commands));
 }
 
 /**
@@ -55,6 +55,19 @@ void OledDriverDisableDisplay(void);
  */
 void OledDriverUpdateDisplay(void);
 
+/**
+ * Start sending a snapshot of rgbOledBmp without blocking; the transfers are made by
+ * OledDriverUpdateService(). Restarts an update still in progress.
+ */
+void OledDriverStartUpdate(void);
+
+/**
+ * Make at most one transfer (a page select or 8 bytes of pixel data) of the update started by
+ * OledDriverStartUpdate(), and only when the I2C arbiter grants the bus to bulk traffic.
+ * @return TRUE once no update is in progress.
+ */
+int OledDriverUpdateService(void);
+
 /**
  * Set the LCD to display pixel values as the opposite of how they are actually stored in NVRAM. So
  * pixels set to black (0) will display as white, and pixels set to white (1) will display as black.
@@ -82,7 +82,11 @@
  *                  // state machine of your design
  *              }
  *          }
- *          
+ *
+ *          NotBopIt wiring: the echo pin goes to PA15 (TIM2_CH1) instead of an EXTI pin. The channel captures
+ *          both edges of the echo in hardware against the 1 MHz TIM2 timebase, so interrupt latency no
+ *          longer shows up in the measured pulse width. The trigger on PB8 is a one-pulse TIM10_CH1 output
+ *          scheduled by PING_Service() according to PING_SetMode(); TIM3 is not used.
  */
 
 #ifndef PING_H
@@ -98,7 +102,19 @@
 #include "stm32f411xe.h"
 #include "stm32f4xx_hal_tim.h"
 
-TIM_HandleTypeDef htim3;
+// ping scheduler modes
+#define PING_OFF        0
+#define PING_NORMAL     1       // one ping every PING_INTERVAL_US
+#define PING_BOOST      2       // next ping as soon as the echo is back
+
+#define PING_INTERVAL_US    60000   // HC-SR04 recommended measurement cycle
+#define PING_MIN_CYCLE_US   10000   // trigger to trigger floor when boosted, lets stray echoes die out
+#define PING_TIMEOUT_US     40000   // the sensor ends a lost echo after 38 ms
+
+// distance filter: echoes outside this range are treated as lost
+#define PING_MEDIAN_N       5       // echoes in the median window
+#define PING_MIN_ECHO_US    115     // ~2 cm, the sensor's minimum range
+#define PING_MAX_ECHO_US    23500   // ~4 m, the sensor's maximum range
 
 /**
  * @function    PING_Init(void)
@@ -110,8 +126,8 @@ char PING_Init(void);
 
 /**
  * @function    PING_GetDistance(void)
- * @brief       Returns the calculated distance in mm using the sensor model determined
- *              experimentally. 
+ * @brief       Returns the distance in mm of the last raw echo, using the speed of
+ *              sound at the temperature given to PING_SetTemperature().
  *              No I/O should be done in this function
  * @return      distance in mm
  */
@@ -125,4 +141,81 @@ unsigned int PING_GetDistance(void);
  */
 unsigned int PING_GetTimeofFlight(void);
 
+/**
+ * @function    PING_GetEchoCount(void)
+ * @brief       Number of echo pulses measured so far; changes whenever a new
+ *              time of flight is available.
+ * @return      echo count
+ */
+uint32_t PING_GetEchoCount(void);
+
+/**
+ * @function    PING_SetMode(uint8_t mode)
+ * @brief       Selects PING_OFF, PING_NORMAL or PING_BOOST. Pinging is off after PING_Init().
+ */
+void PING_SetMode(uint8_t mode);
+
+/**
+ * @function    PING_GetMode(void)
+ * @return      current scheduler mode
+ */
+uint8_t PING_GetMode(void);
+
+/**
+ * @function    PING_Service(void)
+ * @brief       Sends the next trigger when it is due and updates the statistics.
+ *              Call every loop.
+ */
+void PING_Service(void);
+
+/**
+ * @function    PING_GetRate(void)
+ * @brief       Echoes measured during the last whole second.
+ * @return      pings/s
+ */
+unsigned int PING_GetRate(void);
+
+/**
+ * @function    PING_GetLatency(void)
+ * @brief       Time from the last answered trigger to the end of its echo, when the
+ *              distance became available.
+ * @return      latency in uSec
+ */
+unsigned int PING_GetLatency(void);
+
+/**
+ * @function    PING_GetTimeouts(void)
+ * @brief       Triggers that never got a complete echo.
+ * @return      timeout count
+ */
+uint32_t PING_GetTimeouts(void);
+
+/**
+ * @function    PING_SetTemperature(int celsius)
+ * @brief       Air temperature used for the speed of sound (331.3 + 0.6 T m/s),
+ *              20 C until set.
+ */
+void PING_SetTemperature(int celsius);
+
+/**
+ * @function    PING_GetFilteredDistance(void)
+ * @brief       Median of the valid samples among the last PING_MEDIAN_N echoes,
+ *              updated by PING_Service() once per echo.
+ * @return      distance in mm, the last good value while PING_IsValid() is FALSE
+ */
+unsigned int PING_GetFilteredDistance(void);
+
+/**
+ * @function    PING_IsValid(void)
+ * @brief       TRUE while most of the last PING_MEDIAN_N echoes were in range.
+ */
+uint8_t PING_IsValid(void);
+
+/**
+ * @function    PING_GetVelocity(void)
+ * @brief       Rate of change of the filtered distance.
+ * @return      velocity in mm/s, positive when approaching, 0 while not valid
+ */
+int PING_GetVelocity(void);
+
 #endif
\ No newline at end of file
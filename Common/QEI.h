@@ -49,6 +49,10 @@
  *          void QEI_IRQ() {
  *              //state machine of your design
  *          }
+ *
+ *          NotBopIt: with QEI_HARDWARE set, PB4/PB5 are routed to TIM3_CH1/CH2 (AF2) instead and the timer's
+ *          encoder interface mode counts every edge in hardware with its input filter enabled; no interrupt
+ *          fires per edge. QEI_GetPosition() behaves the same with either backend.
  */
 
 #ifndef QEI_H
@@ -64,6 +68,18 @@
 
 #define ENC_A GPIO_PIN_4
 #define ENC_B GPIO_PIN_5
+
+// 1: TIM3 encoder interface mode, 0: EXTI interrupts and the software decoder
+#define QEI_HARDWARE 1
+
+// input filter for the hardware backend: fDTS = 84 MHz / 4, 8 samples at fDTS / 32 (~12 us)
+#define QEI_FILTER 0xF
+
+// velocity estimate: edges counted per window when turning fast, otherwise the period between the
+// last two edges (timestamped in the ISR, or when QEI_Service() sees the hardware count move)
+#define QEI_WINDOW_US   10000   // estimator update period
+#define QEI_FAST_EDGES  4       // edges per window above which counting beats period measurement
+#define QEI_STOP_US     250000  // no edge for this long reads as standing still
  
 /**
  * @function QEI_Init(void)
@@ -89,5 +105,44 @@ int QEI_GetPosition(void);
 */
 void QEI_ResetPosition(); 
 
+/**
+ * @function QEI_GetCount(void)
+ * @param none
+ * @brief  Edges counted since the last reset (96 per revolution) as a 32-bit count that,
+ *         unlike QEI_GetPosition(), does not roll over every turn.
+ * @return accumulated count
+*/
+int32_t QEI_GetCount(void);
+
+/**
+ * @function QEI_GetGlitches(void)
+ * @param none
+ * @brief  Illegal transitions (both channels changed at once) seen by the software decoder.
+ * @return glitch count, always 0 with QEI_HARDWARE
+*/
+uint32_t QEI_GetGlitches(void);
+
+/**
+ * @function QEI_Service(void)
+ * @param none
+ * @brief  Updates the velocity and acceleration estimates every QEI_WINDOW_US. Call every loop.
+ * @return none
+*/
+void QEI_Service(void);
+
+/**
+ * @function QEI_GetVelocity(void)
+ * @param none
+ * @return angular velocity in degrees/s, positive clockwise
+*/
+int QEI_GetVelocity(void);
+
+/**
+ * @function QEI_GetAcceleration(void)
+ * @param none
+ * @return angular acceleration in degrees/s^2, lightly smoothed
+*/
+int QEI_GetAcceleration(void);
+
 #endif	/* QEI_H */
 
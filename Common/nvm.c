@@ -0,0 +1,202 @@
+/**
+ * @file    nvm.c
+ *
+ * Keeps one small record of non-volatile data in a flash sector reserved for
+ * it. The record is stored with its length and a CRC so a blank, stale or torn
+ * sector is never mistaken for valid data.
+ *
+ * Record layout, one 32-bit word per line:
+ *  + NVM_MAGIC
+ *  + length (low half) and ~length (high half)
+ *  + data, padded with 0xFF to a whole word
+ *  + CRC-32 of everything above
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+#include "nvm.h"
+
+
+/*  MODULE-LEVEL DEFINITIONS, MACROS    */
+// Boolean defines for TRUE, FALSE, SUCCESS and ERROR.
+#ifndef FALSE
+#define FALSE ((int8_t) 0)
+#endif  /*  FALSE   */
+#ifndef TRUE
+#define TRUE ((int8_t) 1)
+#endif  /*  TRUE    */
+#ifndef ERROR
+#define ERROR ((int8_t) -1)
+#endif  /*  ERROR   */
+#ifndef SUCCESS
+#define SUCCESS ((int8_t) 1)
+#endif  /*  SUCCESS */
+
+#define NVM_SECTOR FLASH_SECTOR_7
+#define NVM_MAGIC (0x4E564D31)  // "NVM1"
+#define NVM_WORDS(length) (((length) + 3) / 4)
+
+
+/*  PROTOTYPES  */
+static uint32_t NVM_Crc(uint32_t crc, uint32_t word);
+static uint32_t NVM_DataWord(const uint8_t *data, uint16_t length, uint16_t word);
+
+
+/*  FUNCTIONS   */
+/** NVM_Read(data, length)
+ *
+ * Copies the stored record into data if one is present, has exactly the given
+ * length and passes its CRC check.
+ *
+ * @param   data    (uint8_t *) Buffer receiving length bytes.
+ * @param   length  (uint16_t)  Expected record length in bytes.
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t NVM_Read(uint8_t *data, uint16_t length)
+{
+    const volatile uint32_t *record = (const volatile uint32_t *)NVM_SECTOR_ADDRESS;
+    const volatile uint8_t *bytes = (const volatile uint8_t *)&record[2];
+    uint32_t crc = 0xFFFFFFFF;
+    uint16_t i;
+
+    if (length > NVM_MAX_LENGTH || record[0] != NVM_MAGIC ||
+        record[1] != (((uint32_t)(uint16_t)~length << 16) | length))
+    {
+        return ERROR;
+    }
+    for (i = 0; i < 2 + NVM_WORDS(length); i++)
+    {
+        crc = NVM_Crc(crc, record[i]);
+    }
+    if (~crc != record[2 + NVM_WORDS(length)])
+    {
+        return ERROR;
+    }
+    for (i = 0; i < length; i++)
+    {
+        data[i] = bytes[i];
+    }
+    return SUCCESS;
+}
+
+/** NVM_Write(data, length)
+ *
+ * Erases the reserved sector and stores data as the new record. Erasing takes
+ * on the order of a second during which the CPU stalls, so only call this
+ * rarely (e.g. once after a calibration).
+ *
+ * @param   data    (const uint8_t *)   Record to store.
+ * @param   length  (uint16_t)          Record length, at most NVM_MAX_LENGTH.
+ * @return          (int8_t)            [SUCCESS, ERROR]
+ */
+int8_t NVM_Write(const uint8_t *data, uint16_t length)
+{
+    uint32_t address = NVM_SECTOR_ADDRESS;
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t word;
+    uint16_t i;
+    int8_t status = SUCCESS;
+
+    if (length > NVM_MAX_LENGTH || NVM_Erase() != SUCCESS)
+    {
+        return ERROR;
+    }
+
+    HAL_FLASH_Unlock();
+    for (i = 0; i < 3 + NVM_WORDS(length) && status == SUCCESS; i++)
+    {
+        if (i == 0)
+        {
+            word = NVM_MAGIC;
+        }
+        else if (i == 1)
+        {
+            word = ((uint32_t)(uint16_t)~length << 16) | length;
+        }
+        else if (i < 2 + NVM_WORDS(length))
+        {
+            word = NVM_DataWord(data, length, i - 2);
+        }
+        else
+        {
+            word = ~crc;    // CRC goes last so a torn write never validates
+        }
+        crc = NVM_Crc(crc, word);
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, word) != HAL_OK)
+        {
+            printf("NVM program error\r\n");
+            status = ERROR;
+        }
+        address += 4;
+    }
+    HAL_FLASH_Lock();
+    return status;
+}
+
+/** NVM_Erase()
+ *
+ * Erases the reserved sector, discarding any stored record.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t NVM_Erase(void)
+{
+    FLASH_EraseInitTypeDef erase;
+    uint32_t sectorError;
+    HAL_StatusTypeDef ret;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = NVM_SECTOR;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;   // 2.7 - 3.6 V, 32-bit parallelism
+
+    HAL_FLASH_Unlock();
+    ret = HAL_FLASHEx_Erase(&erase, &sectorError);
+    HAL_FLASH_Lock();
+    if (ret != HAL_OK)
+    {
+        printf("NVM erase error\r\n");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/** NVM_Crc(crc, word)
+ *
+ * Folds one little-endian word into a running CRC-32 (reflected, 0xEDB88320).
+ *
+ * @param   crc     (uint32_t)  Running CRC, start with 0xFFFFFFFF.
+ * @param   word    (uint32_t)  Next word of the record.
+ * @return          (uint32_t)  Updated running CRC.
+ */
+static uint32_t NVM_Crc(uint32_t crc, uint32_t word)
+{
+    uint8_t bit;
+
+    crc ^= word;
+    for (bit = 0; bit < 32; bit++)
+    {
+        crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+/** NVM_DataWord(data, length, word)
+ *
+ * Packs bytes of data into the given little-endian record word, padding past
+ * the end of data with erased flash (0xFF).
+ */
+static uint32_t NVM_DataWord(const uint8_t *data, uint16_t length, uint16_t word)
+{
+    uint32_t packed = 0;
+    uint16_t index;
+    int8_t byte;
+
+    for (byte = 3; byte >= 0; byte--)
+    {
+        index = word * 4 + byte;
+        packed = (packed << 8) | ((index < length) ? data[index] : 0xFF);
+    }
+    return packed;
+}
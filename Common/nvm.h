@@ -0,0 +1,57 @@
+/**
+ * @file    nvm.h
+ *
+ * Keeps one small record of non-volatile data in a flash sector reserved for
+ * it. The record is stored with its length and a CRC so a blank, stale or torn
+ * sector is never mistaken for valid data.
+ *
+ * Sector 7 (0x08060000, 128 KB) is the last sector of the STM32F411RE and lies
+ * well past the end of the program image; NotBopIt's linker script
+ * (STM32F411RETX_FLASH.ld) leaves it out of FLASH, so the image cannot grow into it.
+ */
+
+#ifndef NVM_H
+#define	NVM_H
+
+#include <stdint.h>
+
+
+/*  MODULE-LEVEL DEFINITIONS, MACROS    */
+#define NVM_SECTOR_ADDRESS (0x08060000)   // start of flash sector 7
+#define NVM_MAX_LENGTH (256)              // largest record NVM_Write() accepts
+
+
+/*  PROTOTYPES  */
+/** NVM_Read(data, length)
+ *
+ * Copies the stored record into data if one is present, has exactly the given
+ * length and passes its CRC check.
+ *
+ * @param   data    (uint8_t *) Buffer receiving length bytes.
+ * @param   length  (uint16_t)  Expected record length in bytes.
+ * @return          (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t NVM_Read(uint8_t *data, uint16_t length);
+
+/** NVM_Write(data, length)
+ *
+ * Erases the reserved sector and stores data as the new record. Erasing takes
+ * on the order of a second during which the CPU stalls, so only call this
+ * rarely (e.g. once after a calibration).
+ *
+ * @param   data    (const uint8_t *)   Record to store.
+ * @param   length  (uint16_t)          Record length, at most NVM_MAX_LENGTH.
+ * @return          (int8_t)            [SUCCESS, ERROR]
+ */
+int8_t NVM_Write(const uint8_t *data, uint16_t length);
+
+/** NVM_Erase()
+ *
+ * Erases the reserved sector, discarding any stored record.
+ *
+ * @return  (int8_t)    [SUCCESS, ERROR]
+ */
+int8_t NVM_Erase(void);
+
+
+#endif  /* NVM_H */
@@ -22,19 +22,38 @@
 #endif
 
 #define NUM_CHANNELS 6 // number of pwm possible channels
+#define TIM1_CHANNELS 0x0F // masks of the channels on each timer
+#define TIM4_CHANNELS 0x30
+#define DITHER_PRIORITY 3 // below the timing interrupts, a late update only repeats a period
 
 // User-level PWM channels for inits/updating duty cycle etc...
-const PWM PWM_0 = {&htim1, TIM_CHANNEL_1, 0x1};
-const PWM PWM_1 = {&htim1, TIM_CHANNEL_2, 0x2};
-const PWM PWM_2 = {&htim1, TIM_CHANNEL_3, 0x4};
-const PWM PWM_3 = {&htim1, TIM_CHANNEL_4, 0x8};
-const PWM PWM_4 = {&htim4, TIM_CHANNEL_1, 0x10};
-const PWM PWM_5 = {&htim4, TIM_CHANNEL_3, 0x20};
-
-static unsigned int pwm_freq = 1000; // [1 khz] default frequency 
+const PWM PWM_0 = {&htim1, TIM_CHANNEL_1, 0x1,  GPIOA, GPIO_PIN_8,  GPIO_AF1_TIM1};
+const PWM PWM_1 = {&htim1, TIM_CHANNEL_2, 0x2,  GPIOA, GPIO_PIN_9,  GPIO_AF1_TIM1};
+const PWM PWM_2 = {&htim1, TIM_CHANNEL_3, 0x4,  GPIOA, GPIO_PIN_10, GPIO_AF1_TIM1};
+const PWM PWM_3 = {&htim1, TIM_CHANNEL_4, 0x8,  GPIOA, GPIO_PIN_11, GPIO_AF1_TIM1};
+const PWM PWM_4 = {&htim4, TIM_CHANNEL_1, 0x10, GPIOB, GPIO_PIN_6,  GPIO_AF2_TIM4};
+const PWM PWM_5 = {&htim4, TIM_CHANNEL_3, 0x20, GPIOB, GPIO_PIN_8,  GPIO_AF2_TIM4};
+
+// Channel i (mask 1 << i) compare register and the timer whose ARR scales it
+static volatile uint32_t *const ccr_regs[NUM_CHANNELS] = {
+    &TIM1->CCR1, &TIM1->CCR2, &TIM1->CCR3, &TIM1->CCR4, &TIM4->CCR1, &TIM4->CCR3
+};
+static TIM_TypeDef *const ccr_timers[NUM_CHANNELS] = {TIM1, TIM1, TIM1, TIM1, TIM4, TIM4};
+
+static unsigned int timer_freqs[2] = {1000, 1000}; // [1 khz] default frequency of TIM1 and TIM4
 static uint32_t duty_cycles[NUM_CHANNELS]; // to store the duty cycles of each channel
+static uint16_t duty16[NUM_CHANNELS]; // duty cycles of the channels set by PWM_SetDuty16()
+static volatile uint32_t ccr_levels[NUM_CHANNELS]; // CCR in 16.16 fixed point, read by the dithering
+static uint16_t dither_sums[NUM_CHANNELS]; // fraction of a count carried to the next period
 static uint8_t init_status = FALSE;
 static unsigned char pinsAdded = 0x00;
+static unsigned char fineChannels = 0x00; // channels last set by PWM_SetDuty16()
+static volatile unsigned char ditherChannels = 0x00;
+
+static void PWM_WriteDuty(int i, unsigned int Duty);
+static void PWM_WriteChannel(int i);
+static void PWM_WriteDuty16(int i, uint16_t Duty);
+static void PWM_Dither(unsigned char channels);
 
 /**
  * @Function PWM_Init(void)
@@ -55,7 +74,7 @@ char PWM_Init(void) {
         htim1.Init.Period = 999; // deafault frequecy of 1 khz, changed by modifying ARRx register
         htim1.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
         htim1.Init.RepetitionCounter = 0;
-        htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+        htim1.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE; // a new period starts with the next cycle
         if (HAL_TIM_Base_Init(&htim1) != HAL_OK)
         {
             return ERROR;
@@ -82,7 +101,7 @@ char PWM_Init(void) {
         htim4.Init.CounterMode = TIM_COUNTERMODE_UP;
         htim4.Init.Period = 999; // deafault frequecy of 1 khz, changed by modifying ARRx register
         htim4.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-        htim4.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+        htim4.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_ENABLE; // a new period starts with the next cycle
         if (HAL_TIM_Base_Init(&htim4) != HAL_OK)
         {
             return ERROR;
@@ -134,7 +153,21 @@ char PWM_AddPin(PWM PWM_x) {
         return ERROR;
     }
     pinsAdded = pinsAdded | PWM_x.mask; // record added pin for book keeping
-    HAL_TIM_MspPostInit(PWM_x.timer);
+
+    // route this pin only; HAL_TIM_MspPostInit() would take all of the timer's pins
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    if (PWM_x.port == GPIOA) {
+        __HAL_RCC_GPIOA_CLK_ENABLE();
+    } else {
+        __HAL_RCC_GPIOB_CLK_ENABLE();
+    }
+    GPIO_InitStruct.Pin = PWM_x.pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = PWM_x.alternate;
+    HAL_GPIO_Init(PWM_x.port, &GPIO_InitStruct);
+
     HAL_TIM_PWM_Start(PWM_x.timer, PWM_x.channel);
     //PWM_SetDutyCycle(PWM_x, 50); // init to 50% DC
     return SUCCESS;
@@ -144,10 +177,25 @@ char PWM_AddPin(PWM PWM_x) {
  * @Function PWM_SetFrequency(unsigned int NewFrequency)
  * @param NewFrequency - new frequency to set. must be between 100 hz and 100 khz
  * @return SUCCESS OR ERROR
- * @brief  Changes the frequency of the PWM system.
- * @note  Behavior of PWM channels during Frequency change is undocumented
+ * @brief  Changes the frequency of the PWM system, both timers.
+ * @note  See PWM_SetTimerFrequency()
  * @author Adam Korycki, 2023.10.05 */
 char PWM_SetFrequency(unsigned int NewFrequency) {
+    if (PWM_SetTimerFrequency(&htim1, NewFrequency) == ERROR) {
+        return ERROR;
+    }
+    return PWM_SetTimerFrequency(&htim4, NewFrequency);
+}
+
+/**
+ * @Function PWM_SetTimerFrequency(TIM_HandleTypeDef *timer, unsigned int NewFrequency)
+ * @param timer - &htim1 (PWM_0 to PWM_3) or &htim4 (PWM_4, PWM_5)
+ * @param NewFrequency - new frequency to set. must be between 100 hz and 100 khz
+ * @return SUCCESS OR ERROR
+ * @brief  Changes the frequency of one timer's channels only, keeping their duty
+ *         cycles. ARR and the CCRs are preloaded, so they switch together at the
+ *         end of the current period. */
+char PWM_SetTimerFrequency(TIM_HandleTypeDef *timer, unsigned int NewFrequency) {
     if (init_status == FALSE) { // if pwm module has not been initialized
         printf("ERROR: PWM module has not yet been initialized!\r\n");
         return ERROR;
@@ -155,48 +203,53 @@ char PWM_SetFrequency(unsigned int NewFrequency) {
     if ((NewFrequency < 100) || (NewFrequency > 100000)) { // if requested frequency is out of bounds
         return ERROR;
     }
+    int t = (timer == &htim1) ? 0 : 1;
+    if (timer_freqs[t] == NewFrequency) {
+        return SUCCESS; // fast path, nothing to change
+    }
     
-    TIM1->ARR = TIM4->ARR = (uint32_t)(1000000.0/NewFrequency) - 1; // set auto-reload registers (ARR) accordingly (1 Mhz timer)
-    pwm_freq = NewFrequency;
-
-    // update to preserve duty cycle after frequency change
-    unsigned char mask = 1;
-    for (int i = 0; i < NUM_CHANNELS; i++) {
-        if ((pinsAdded & mask) != 0) { // if pin i has been added, update duty cycle with new frequency
-            switch(i) {
-                case 0:
-                    PWM_SetDutyCycle(PWM_0, duty_cycles[i]);
-                    break;
-                case 1:
-                    PWM_SetDutyCycle(PWM_1, duty_cycles[i]);
-                    break;
-                case 2:
-                    PWM_SetDutyCycle(PWM_2, duty_cycles[i]);
-                    break;
-                case 3:
-                    PWM_SetDutyCycle(PWM_3, duty_cycles[i]);
-                    break;
-                case 4:
-                    PWM_SetDutyCycle(PWM_4, duty_cycles[i]);
-                    break;
-                case 5:
-                    PWM_SetDutyCycle(PWM_5, duty_cycles[i]);
-                    break;
-            }
+    timer->Instance->ARR = 1000000 / NewFrequency - 1; // set auto-reload register (ARR) accordingly (1 Mhz timer)
+    timer_freqs[t] = NewFrequency;
+
+    // update to preserve duty cycle after frequency change, this timer's channels only
+    unsigned char channels = pinsAdded & ((t == 0) ? TIM1_CHANNELS : TIM4_CHANNELS);
+    for (int i = 0; channels != 0; i++, channels >>= 1) {
+        if ((channels & 1) != 0) { // if pin i has been added, update duty cycle with new frequency
+            PWM_WriteChannel(i);
         }
-        mask = mask << 1; // shift bitmask
     }
 
     return SUCCESS;
 }
 
+/**
+ * @Function PWM_GetTimerFrequency(TIM_HandleTypeDef *timer)
+ * @param timer - &htim1 or &htim4
+ * @return Frequency of the timer in Hertz */
+unsigned int PWM_GetTimerFrequency(TIM_HandleTypeDef *timer) {
+    return timer_freqs[(timer == &htim1) ? 0 : 1];
+}
+
 /**
  * @Function PWM_GetFrequency(void)
  * @return Frequency of system in Hertz
- * @brief  gets the frequency of the PWM system.
+ * @brief  gets the frequency of the PWM system (the TIM1 frequency).
  * @author Adam Korycki, 2023.10.05 */
 unsigned int PWM_GetFrequency(void) {
-    return pwm_freq;
+    return timer_freqs[0];
+}
+
+/**
+ * Function  PWM_WriteChannel
+ * @param i - channel index
+ * @return None
+ * @remark Rewrites the channel's stored duty cycle against its timer's current period. */
+static void PWM_WriteChannel(int i) {
+    if ((fineChannels & (1 << i)) != 0) {
+        PWM_WriteDuty16(i, duty16[i]);
+    } else {
+        PWM_WriteDuty(i, duty_cycles[i]);
+    }
 }
 
 /**
@@ -204,9 +257,17 @@ unsigned int PWM_GetFrequency(void) {
  * @param PWM_x - PWM channel to start and set duty cyle
  * @param Duty - duty cycle for the channel (0-100)
  * @return SUCCESS or ERROR
- * @remark Enables the pwm pin if not already enabled and sets the Duty Cycle for a Single Channel
+ * @remark Enables the pwm pin if not already enabled and sets the Duty Cycle for a Single Channel.
+ *         Cheap to call repeatedly: an unchanged duty cycle returns without touching the timer.
  * @author Adam Korycki, 2023.10.05  */
 char PWM_SetDutyCycle(PWM PWM_x, unsigned int Duty) {
+    int i = __builtin_ctz(PWM_x.mask); // channel index, PWM_x.mask == 1 << i
+
+    if (init_status == TRUE && (pinsAdded & PWM_x.mask) != 0 && (fineChannels & PWM_x.mask) == 0
+        && duty_cycles[i] == Duty) {
+        return SUCCESS; // fast path, nothing to change
+    }
+
     if (init_status == FALSE) { // if pwm module has not been initialized
         printf("ERROR: PWM module has not yet been initialized!\r\n");
         return ERROR;
@@ -219,36 +280,135 @@ char PWM_SetDutyCycle(PWM PWM_x, unsigned int Duty) {
         return ERROR;
     }
     
-    switch(PWM_x.mask) { // set capture compare register (CCR) to correct value and save duty cycle value
-        case 0x1: // PWM_0
-            TIM1->CCR1 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[0] = Duty;
-            break;
-        case 0x2: // PWM_1
-            TIM1->CCR2 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[1] = Duty;
-            break;
-        case 0x4: // PWM_2
-            TIM1->CCR3 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[2] = Duty;
-            break;
-        case 0x8: // PWM_3
-            TIM1->CCR4 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[3] = Duty;
-            break;
-        case 0x10: // PWM_4
-            TIM4->CCR1 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[4] = Duty;
-            break;
-        case 0x20: // PWM_5
-            TIM4->CCR3 = (uint32_t)((Duty/100.0)*(TIM1->ARR));
-            duty_cycles[5] = Duty;
-            break;
+    PWM_WriteDuty(i, Duty);
+    return SUCCESS;
+}
+
+/**
+ * Function  PWM_WriteDuty
+ * @param i - channel index
+ * @param Duty - duty cycle for the channel (0-100)
+ * @return None
+ * @remark Sets the capture compare register (CCR) from the channel's own timer
+ *         period in integer math (Duty * ARR fits easily in 32 bits) and saves
+ *         the duty cycle value. */
+static void PWM_WriteDuty(int i, unsigned int Duty) {
+    uint32_t ccr = (Duty * ccr_timers[i]->ARR) / 100;
+    ccr_levels[i] = ccr << 16;
+    *ccr_regs[i] = ccr;
+    duty_cycles[i] = Duty;
+    fineChannels &= ~(1 << i);
+}
+
+/**
+ * Function  PWM_SetDuty16
+ * @param PWM_x - PWM channel to start and set duty cyle
+ * @param Duty - duty cycle for the channel (0-PWM_DUTY16_MAX)
+ * @return SUCCESS or ERROR
+ * @remark PWM_SetDutyCycle() using the full ARR range, see PWM_SetDithering() */
+char PWM_SetDuty16(PWM PWM_x, uint16_t Duty) {
+    int i = __builtin_ctz(PWM_x.mask); // channel index, PWM_x.mask == 1 << i
+
+    if (init_status == TRUE && (fineChannels & PWM_x.mask) != 0 && duty16[i] == Duty) {
+        return SUCCESS; // fast path, nothing to change (fineChannels implies the pin was added)
     }
+    if (init_status == FALSE) { // if pwm module has not been initialized
+        printf("ERROR: PWM module has not yet been initialized!\r\n");
+        return ERROR;
+    }
+    if ((pinsAdded & PWM_x.mask) == 0) { // if pin has not been added, add pin
+        PWM_AddPin(PWM_x);
+    }
+    PWM_WriteDuty16(i, Duty);
+    return SUCCESS;
+}
+
+/**
+ * Function  PWM_WriteDuty16
+ * @param i - channel index
+ * @param Duty - duty cycle for the channel (0-PWM_DUTY16_MAX)
+ * @return None
+ * @remark Duty is stretched to 0-0x10000 so that PWM_DUTY16_MAX gives CCR = ARR + 1,
+ *         on for the whole period; the level is CCR in 16.16 fixed point, whose
+ *         fraction the dithering spreads over the periods. ARR + 1 <= 10000 at
+ *         the lowest frequency, so the level fits in 32 bits. */
+static void PWM_WriteDuty16(int i, uint16_t Duty) {
+    uint32_t level = (Duty + (Duty >> 15)) * (ccr_timers[i]->ARR + 1);
+    ccr_levels[i] = level;
+    *ccr_regs[i] = (level + 0x8000) >> 16; // rounded; refined by the next update when dithering
+    duty16[i] = Duty;
+    fineChannels |= (1 << i);
+}
 
+/**
+ * Function  PWM_SetDithering
+ * @param PWM_x - PWM channel to dither
+ * @param Enable - TRUE or FALSE
+ * @return SUCCESS or ERROR
+ * @remark Enables the pwm pin if not already enabled; the timer's update interrupt
+ *         runs while any of its channels dithers. */
+char PWM_SetDithering(PWM PWM_x, char Enable) {
+    if (init_status == FALSE) { // if pwm module has not been initialized
+        printf("ERROR: PWM module has not yet been initialized!\r\n");
+        return ERROR;
+    }
+    if ((pinsAdded & PWM_x.mask) == 0) { // if pin has not been added, add pin
+        PWM_AddPin(PWM_x);
+    }
+    int i = __builtin_ctz(PWM_x.mask);
+    unsigned char timerChannels = (PWM_x.timer == &htim1) ? TIM1_CHANNELS : TIM4_CHANNELS;
+    IRQn_Type irq = (PWM_x.timer == &htim1) ? TIM1_UP_TIM10_IRQn : TIM4_IRQn;
+
+    if (Enable) {
+        ditherChannels |= PWM_x.mask;
+    } else {
+        ditherChannels &= ~PWM_x.mask;
+        *ccr_regs[i] = (ccr_levels[i] + 0x8000) >> 16; // back to the rounded duty cycle
+    }
+    if ((ditherChannels & timerChannels) != 0) {
+        HAL_NVIC_SetPriority(irq, DITHER_PRIORITY, 0);
+        HAL_NVIC_EnableIRQ(irq);
+        __HAL_TIM_ENABLE_IT(PWM_x.timer, TIM_IT_UPDATE);
+    } else {
+        __HAL_TIM_DISABLE_IT(PWM_x.timer, TIM_IT_UPDATE);
+    }
     return SUCCESS;
 }
 
+/**
+ * Function  PWM_Dither
+ * @param channels - mask of the dithering channels of the timer that updated
+ * @return None
+ * @remark First order sigma-delta: each period adds the fraction of the level to
+ *         a running sum and takes one extra count whenever the sum overflows. The
+ *         CCRs are preloaded, so the new value applies to the period after next. */
+static void PWM_Dither(unsigned char channels) {
+    for (int i = 0; channels != 0; i++, channels >>= 1) {
+        if ((channels & 1) != 0) {
+            uint32_t level = ccr_levels[i];
+            uint32_t sum = dither_sums[i] + (level & 0xFFFF);
+            *ccr_regs[i] = (level >> 16) + (sum >> 16);
+            dither_sums[i] = (uint16_t)sum;
+        }
+    }
+}
+
+/* TIM1 update interrupt; TIM10 (the PING trigger) shares the vector but raises no interrupts */
+void TIM1_UP_TIM10_IRQHandler(void) {
+    if ((TIM1->SR & TIM_SR_UIF) != 0) {
+        TIM1->SR = ~TIM_SR_UIF;
+        PWM_Dither(ditherChannels & TIM1_CHANNELS);
+    }
+}
+
+/* TIM4 update interrupt */
+void TIM4_IRQHandler(void) {
+    if ((TIM4->SR & TIM_SR_UIF) != 0) {
+        TIM4->SR = ~TIM_SR_UIF;
+        PWM_Dither(ditherChannels & TIM4_CHANNELS);
+    }
+}
+
 /**
  * Function: PWM_Start
  * @param PWM_x - PWM channel to start
@@ -302,7 +462,10 @@ char PWM_End(void) {
         printf("ERROR: PWM module has not yet been initialized!\r\n");
         return ERROR;
     }
-    // stop all pwm channels
+    // stop dithering and all pwm channels
+    ditherChannels = 0x00;
+    __HAL_TIM_DISABLE_IT(&htim1, TIM_IT_UPDATE);
+    __HAL_TIM_DISABLE_IT(&htim4, TIM_IT_UPDATE);
     HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_1);
     HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_2);
     HAL_TIM_PWM_Stop(&htim1, TIM_CHANNEL_3);
@@ -373,4 +536,77 @@ int main(void) {
     while (TRUE);
 }
 
+#endif
+
+// PWM BENCHMARK HARNESS
+//#define PWM_BENCHMARK
+#ifdef PWM_BENCHMARK
+// SUCCESS - prints the cycles per call for the former switch and double precision
+//           update, for PWM_SetDutyCycle() with a new duty cycle every call and
+//           for PWM_SetDutyCycle() repeating the duty cycle, as updateRGBLED() does
+//           most of the time; the three channel CCRs end up the same either way
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <Board.h>
+#include <timers.h>
+#include <pwm.h>
+
+// the former update, kept here for comparison
+static void legacySetDutyCycle(PWM PWM_x, unsigned int Duty) {
+    switch(PWM_x.mask) {
+        case 0x2: TIM1->CCR2 = (uint32_t)((Duty/100.0)*(TIM1->ARR)); duty_cycles[1] = Duty; break;
+        case 0x4: TIM1->CCR3 = (uint32_t)((Duty/100.0)*(TIM1->ARR)); duty_cycles[2] = Duty; break;
+        case 0x8: TIM1->CCR4 = (uint32_t)((Duty/100.0)*(TIM1->ARR)); duty_cycles[3] = Duty; break;
+    }
+}
+
+int main(void) {
+    BOARD_Init();
+    TIMER_Init();
+    PWM_Init();
+    PWM_SetDutyCycle(PWM_1, 0); // add the RGB pins first
+    PWM_SetDutyCycle(PWM_2, 0);
+    PWM_SetDutyCycle(PWM_3, 0);
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // enable the cycle counter
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    const int calls = 3000;
+    uint32_t start, legacy, changed, repeated;
+
+    start = DWT->CYCCNT;
+    for (int n = 0; n < calls / 3; n++) {
+        legacySetDutyCycle(PWM_1, n % 101);
+        legacySetDutyCycle(PWM_2, (n + 33) % 101);
+        legacySetDutyCycle(PWM_3, (n + 66) % 101);
+    }
+    legacy = DWT->CYCCNT - start;
+    uint32_t legacyCCR = TIM1->CCR2 + TIM1->CCR3 + TIM1->CCR4;
+
+    start = DWT->CYCCNT;
+    for (int n = 0; n < calls / 3; n++) {
+        PWM_SetDutyCycle(PWM_1, n % 101);
+        PWM_SetDutyCycle(PWM_2, (n + 33) % 101);
+        PWM_SetDutyCycle(PWM_3, (n + 66) % 101);
+    }
+    changed = DWT->CYCCNT - start;
+    uint32_t fastCCR = TIM1->CCR2 + TIM1->CCR3 + TIM1->CCR4;
+
+    start = DWT->CYCCNT;
+    for (int n = 0; n < calls / 3; n++) {
+        PWM_SetDutyCycle(PWM_1, 40);
+        PWM_SetDutyCycle(PWM_2, 50);
+        PWM_SetDutyCycle(PWM_3, 60);
+    }
+    repeated = DWT->CYCCNT - start;
+
+    printf("CCR sums: legacy %lu, integer %lu\r\n", (unsigned long)legacyCCR, (unsigned long)fastCCR);
+    printf("cycles per call: legacy %lu, changed %lu, repeated %lu\r\n",
+        (unsigned long)(legacy / calls), (unsigned long)(changed / calls), (unsigned long)(repeated / calls));
+
+    while (TRUE);
+}
+
 #endif
\ No newline at end of file
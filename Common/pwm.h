@@ -18,11 +18,17 @@ void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
 TIM_HandleTypeDef htim1;
 TIM_HandleTypeDef htim4;
 
+#define PWM_DUTY16_MAX 0xFFFF // full scale of PWM_SetDuty16(), always on
+
 // pwm channel struct with timer and channel attributes + bit mask for book keeping
+// and the output pin, which PWM_AddPin() configures alone (PB8 may belong to another timer)
 typedef struct PWM {
     TIM_HandleTypeDef* timer;
     unsigned int channel;
     unsigned char mask;
+    GPIO_TypeDef* port;
+    uint16_t pin;
+    uint8_t alternate;
 } PWM;  
 
 // user-level PWM channels
@@ -46,15 +52,31 @@ char PWM_Init(void);
  * @Function PWM_SetFrequency(unsigned int NewFrequency)
  * @param NewFrequency - new frequency to set. must be between 100 hz and 100 khz
  * @return SUCCESS OR ERROR
- * @brief  Changes the frequency of the PWM system.
- * @note  Behavior of PWM channels during Frequency change is undocumented
+ * @brief  Changes the frequency of the PWM system, both timers.
+ * @note  See PWM_SetTimerFrequency()
  * @author Adam Korycki, 2023.10.05 */
 char PWM_SetFrequency(unsigned int NewFrequency);
 
+/**
+ * @Function PWM_SetTimerFrequency(TIM_HandleTypeDef *timer, unsigned int NewFrequency)
+ * @param timer - &htim1 (PWM_0 to PWM_3) or &htim4 (PWM_4, PWM_5)
+ * @param NewFrequency - new frequency to set. must be between 100 hz and 100 khz
+ * @return SUCCESS OR ERROR
+ * @brief  Changes the frequency of one timer's channels only, keeping their duty
+ *         cycles. The period and duty cycles switch together at the end of the
+ *         current period; an unchanged frequency returns at once. */
+char PWM_SetTimerFrequency(TIM_HandleTypeDef *timer, unsigned int NewFrequency);
+
+/**
+ * @Function PWM_GetTimerFrequency(TIM_HandleTypeDef *timer)
+ * @param timer - &htim1 or &htim4
+ * @return Frequency of the timer in Hertz */
+unsigned int PWM_GetTimerFrequency(TIM_HandleTypeDef *timer);
+
 /**
  * @Function PWM_GetFrequency(void)
  * @return Frequency of system in Hertz
- * @brief  gets the frequency of the PWM system.
+ * @brief  gets the frequency of the PWM system (the TIM1 frequency, see PWM_GetTimerFrequency()).
  * @author Adam Korycki, 2023.10.05 */
 unsigned int PWM_GetFrequency(void);
 
@@ -75,6 +97,29 @@ char PWM_AddPin(PWM PWM_x);
  * @author Adam Korycki, 2023.10.05  */
 char PWM_SetDutyCycle(PWM PWM_x, unsigned int Duty);
 
+/**
+ * Function  PWM_SetDuty16(PWM PWM_x, uint16_t Duty)
+ * @param PWM_x - PWM channel to start and set duty cyle
+ * @param Duty - duty cycle for the channel (0-PWM_DUTY16_MAX)
+ * @return SUCCESS or ERROR
+ * @remark PWM_SetDutyCycle() using the full ARR range. The part of a timer count
+ *         that Duty asks for beyond whole counts is rounded off, or spread over
+ *         the following periods once PWM_SetDithering() is on. An unchanged duty
+ *         cycle returns without touching the timer. */
+char PWM_SetDuty16(PWM PWM_x, uint16_t Duty);
+
+/**
+ * Function  PWM_SetDithering(PWM PWM_x, char Enable)
+ * @param PWM_x - PWM channel to dither
+ * @param Enable - TRUE or FALSE
+ * @return SUCCESS or ERROR
+ * @remark Sigma-delta dithering of the PWM_SetDuty16() duty cycle: the timer's
+ *         update interrupt carries the fraction of a count from period to period,
+ *         so the average duty cycle matches Duty with no work in the main loop.
+ *         The interrupt runs once per PWM period while any channel of the timer
+ *         dithers. */
+char PWM_SetDithering(PWM PWM_x, char Enable);
+
 /**
  * Function: PWM_Start
  * @param PWM_x - PWM channel to start
@@ -20,16 +20,19 @@
 #define SUCCESS ((int8_t) 1)
 #endif
 
+#define TIMERS_WRAP (0x100000000ULL) // TIM2 counts 2^32 us between updates (~71.6 minutes)
+
 static uint8_t init_status = FALSE;
 
-static uint32_t us; //microsecond count
-static uint32_t ms; //millisecond count
+static volatile uint64_t us; //microsecond count at the last update (a multiple of TIMERS_WRAP), never wraps
 
 /**
  * @function TIMER_Init(void)
  * @param None
  * @return SUCCESS or ERROR
- * @brief Initializes and starts the timer (TIM2) peripheral
+ * @brief Initializes and starts the timer (TIM2) peripheral. TIM2 is the only
+ *        time base: it runs free at 1 MHz over its whole 32-bit range, so its
+ *        counter is the microsecond count and it interrupts only on the wrap.
  * @author Adam Korycki, 2023.09.29 */
 char TIMER_Init(void) {
     if (init_status == FALSE) { // if TIM2 module has not been initialized
@@ -40,7 +43,7 @@ char TIMER_Init(void) {
         htim2.Instance = TIM2;
         htim2.Init.Prescaler = system_clock_freq - 1; // setting prescaler for 1 Mhz timer clock
         htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
-        htim2.Init.Period = 999; //trigger interrupt every 1ms
+        htim2.Init.Period = 0xFFFFFFFF; //free-running, update only on the 32-bit wrap
         htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
         htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
         if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
@@ -59,12 +62,44 @@ char TIMER_Init(void) {
             return ERROR;
         }
 
+        __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE); // the init's update event is not a wrap
         HAL_TIM_Base_Start_IT(&htim2); // start interrupt
         init_status = TRUE;
     }
     return SUCCESS;
 }
 
+/**
+ * @function HAL_InitTick(uint32_t TickPriority)
+ * @param TickPriority - unused, TIM2 keeps the priority of its MSP init
+ * @return HAL_OK or HAL_ERROR
+ * @brief Replaces the HAL's SysTick time base, which stays off: HAL_Init()
+ *        starts TIM2 here, and after HAL_RCC_ClockConfig() changed the clock
+ *        the prescaler is reloaded at once, keeping the count. */
+HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority) {
+    if (init_status == FALSE) {
+        return (TIMER_Init() == SUCCESS) ? HAL_OK : HAL_ERROR;
+    }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t cnt = TIM2->CNT;
+    TIM2->PSC = TIMERS_GetSystemClockFreq() / 1000000 - 1;
+    TIM2->EGR = TIM_EGR_UG;  // load the prescaler now, this clears the counter
+    TIM2->CNT = cnt;
+    TIM2->SR = ~TIM_SR_UIF;
+    __set_PRIMASK(primask);
+    return HAL_OK;
+}
+
+/**
+ * @function HAL_GetTick(void)
+ * @param None
+ * @return current millisecond count
+ * @brief HAL timeouts and HAL_Delay() run on TIM2 as well. */
+uint32_t HAL_GetTick(void) {
+    return TIMERS_GetMilliSeconds();
+}
+
 /**
  * @function TIMERS_GetMilliSeconds(void)
  * @param None
@@ -72,7 +107,7 @@ char TIMER_Init(void) {
  * @brief ^
  * @author Adam Korycki, 2023.09.29 */
 uint32_t TIMERS_GetMilliSeconds(void) {
-    return ms;
+    return (uint32_t)(TIMERS_GetMicroSeconds64() / 1000);
 }
 
 /**
@@ -82,7 +117,62 @@ uint32_t TIMERS_GetMilliSeconds(void) {
  * @brief ^
  * @author Adam Korycki, 2023.09.29 */
 uint32_t TIMERS_GetMicroSeconds(void) {
-    return us + TIM2->CNT; // (ms*1000) + (current value of 1Mhz counter)
+    return TIM2->CNT; // low 32 bits of the count, wraps every ~71 minutes, differences stay correct
+}
+
+/**
+ * @function TIMERS_GetMicroSeconds64(void)
+ * @param None
+ * @return current microsecond count, monotonic and without wrap
+ * @brief The count at the last update and TIM2->CNT are read as one snapshot:
+ *        the read is retried if the update interrupt ran in between, and a
+ *        wrap whose interrupt is still pending (interrupts masked, or called
+ *        from an interrupt) is accounted for. */
+uint64_t TIMERS_GetMicroSeconds64(void) {
+    uint64_t base;
+    uint32_t cnt, pending;
+    do {
+        base = us;
+        cnt = TIM2->CNT;
+        pending = TIM2->SR & TIM_SR_UIF;
+    } while (base != us);
+    if (pending && cnt < 0x80000000) { // wrapped before cnt was read, update not yet counted
+        base += TIMERS_WRAP;
+    }
+    return base + cnt; // (updates * 2^32) + (current value of 1Mhz counter)
+}
+
+/**
+ * @function TIMERS_CaptureToMicroSeconds(uint32_t capture)
+ * @param capture - TIM2 capture register value
+ * @return microsecond count at which the capture was taken
+ * @brief TIM2 counts the low 32 bits of the microsecond count itself, so a
+ *        capture already is a TIMERS_GetMicroSeconds() timestamp. */
+uint32_t TIMERS_CaptureToMicroSeconds(uint32_t capture) {
+    return capture;
+}
+
+/**
+ * @function TIMERS_SetWakeup(uint32_t deadline)
+ * @param deadline - TIMERS_GetMicroSeconds() time to interrupt at
+ * @return None
+ * @brief Arms TIM2 channel 2 to interrupt when the count reaches deadline, so
+ *        a WFI sleep ends on time without a periodic tick. A deadline already
+ *        passed only fires after the next wrap; check before sleeping. */
+void TIMERS_SetWakeup(uint32_t deadline) {
+    TIM2->CCR2 = deadline;
+    TIM2->SR = ~TIM_SR_CC2IF;
+    TIM2->DIER |= TIM_DIER_CC2IE;
+}
+
+/**
+ * @function TIMERS_ClearWakeup(void)
+ * @param None
+ * @return None
+ * @brief Disarms the interrupt set by TIMERS_SetWakeup(). */
+void TIMERS_ClearWakeup(void) {
+    TIM2->DIER &= ~TIM_DIER_CC2IE;
+    TIM2->SR = ~TIM_SR_CC2IF;
 }
 
 /**
@@ -98,8 +188,7 @@ uint32_t TIMERS_GetSystemClockFreq(void) {
 /* timer callback */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
     if (htim == &htim2) {
-        ms++;     // update millisecond count
-        us+=1000; // update microsecond count
+        us += TIMERS_WRAP; // update microsecond count
     }
 }
 
@@ -119,8 +208,17 @@ int main(void) {
 
     uint32_t init_ms = TIMERS_GetMilliSeconds();
     uint32_t init_us = TIMERS_GetMicroSeconds();
+    uint64_t last = TIMERS_GetMicroSeconds64();
+    uint32_t backwards = 0;
     while(TRUE) {
         printf("ms: %011d\r\nus: %011d\r\n\r\n", TIMERS_GetMilliSeconds()-init_ms, TIMERS_GetMicroSeconds()-init_us);
+        // SUCCESS - the 64-bit count never steps backwards, also across updates
+        for (int i = 0; i < 100000; i++) {
+            uint64_t now = TIMERS_GetMicroSeconds64();
+            if (now < last) { backwards++; }
+            last = now;
+        }
+        printf("backward steps: %lu\r\n", (unsigned long)backwards);
         HAL_Delay(1);
     }
 }
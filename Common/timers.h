@@ -19,7 +19,8 @@ TIM_HandleTypeDef htim2;
  * @function TIMER_Init(void)
  * @param None
  * @return SUCCESS or ERROR
- * @brief Initializes the timer (TIM2) peripheral
+ * @brief Initializes the timer (TIM2) peripheral, the single time base:
+ *        free-running at 1 MHz, it also serves HAL_GetTick() (SysTick is off)
  * @author Adam Korycki, 2023.09.29 */
 char TIMER_Init(void);
 
@@ -39,6 +40,36 @@ uint32_t TIMERS_GetMilliSeconds(void);
  * @author Adam Korycki, 2023.09.29 */
 uint32_t TIMERS_GetMicroSeconds(void);
 
+/**
+ * @function TIMERS_GetMicroSeconds64(void)
+ * @param None
+ * @return current microsecond count, monotonic and without wrap
+ * @brief Tear-free snapshot of the update count and TIM2; TIMERS_GetMicroSeconds()
+ *        is its low 32 bits. Safe to call from interrupts. */
+uint64_t TIMERS_GetMicroSeconds64(void);
+
+/**
+ * @function TIMERS_CaptureToMicroSeconds(uint32_t capture)
+ * @param capture - TIM2 capture register value
+ * @return microsecond count at which the capture was taken
+ * @brief TIM2 runs over the full 32 bits, so this is the capture itself. */
+uint32_t TIMERS_CaptureToMicroSeconds(uint32_t capture);
+
+/**
+ * @function TIMERS_SetWakeup(uint32_t deadline)
+ * @param deadline - TIMERS_GetMicroSeconds() time to interrupt at
+ * @return None
+ * @brief Arms a TIM2 compare interrupt (channel 2) at deadline, to end a WFI
+ *        sleep; it fires only when the count reaches deadline after the call. */
+void TIMERS_SetWakeup(uint32_t deadline);
+
+/**
+ * @function TIMERS_ClearWakeup(void)
+ * @param None
+ * @return None
+ * @brief Disarms the interrupt set by TIMERS_SetWakeup(). */
+void TIMERS_ClearWakeup(void);
+
 /**
  * @function TIMERS_GetSystemClockFreq(void)
  * @param None
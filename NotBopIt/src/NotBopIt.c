@@ -5,15 +5,52 @@
 #include <light.h>          // lib: provides RGB control functions
 #include <sound.h>          // lib: provides sound control functions
 #include <sensors.h>        // lib: provides sensor interpretation functions
+#include <alarm.h>          // lib: provides deadlines for timed states
+#include <idle.h>           // lib: sleeps until the next interrupt or deadline
+#include <tasks.h>          // lib: runs the game, sensors, lights, display and telemetry at fixed rates
+#include <Oled.h>           // lib: provides the display
+
+// Uncomment to print scheduler, I2C, ping and idle statistics to serial. printf() blocks on the
+// UART (115200 baud), so each report line holds the CPU for about 8 ms and the 1 kHz tasks
+// overrun while it prints: turn it on to measure, not to play.
+//#define TASKS_TELEMETRY
+#ifdef TASKS_TELEMETRY
+#include <I2C.h>            // lib: provides bus statistics
+#include <PING.h>           // lib: provides ping statistics
+#include <BNO055.h>         // lib: provides the IMU bus address
+#endif
 
 #define TRIALS 6                // trials per level
 #define LEVELS 6                // levels per game
+#define CALIB_SAVE_IDLE_MS 10000    // initialization left alone this long before the IMU calibration is saved
+
+#define TASK_SENSORS_US     1000    // 1 kHz sensor poll (the IMU paces its own 100 Hz frames within it)
+#define TASK_GAME_US        1000    // 1 kHz state machine, sound and light
+#define TASK_LIGHT_US       5000    // 200 Hz RGB LED PWM update
+#define TASK_DISPLAY_US     50000   // 20 Hz display redraw, when the game status changed
+#define TASK_OLED_US        2000    // one display chunk (~0.9 ms) every other ms while a frame is being sent
+#define TASK_QUIET_US       20000   // 50 Hz game and light, while the game expects no quick input
+#define TASK_SENSORS_QUIET_US IMU_PERIOD_US  // keeps the IMU frames coming while the game is quiet
+#ifdef TASKS_TELEMETRY
+#define TASK_TELEMETRY_US   100000  // 10 Hz, one report line per run
+#define DISPLAY_ADDRESS     0x3C    // SSD1306, see OledDriver.c
+#endif
 
 void    state();                        // run state machine
 void    soundAndLight();                // control light and sound output
 void    transitionTo (int state);       // transition between states
 int     selectSensor();                 // select sensor from random number generator
 int     checkLevelChange(int level);    // update level changed flag
+void    scheduleState();                // register the timed segments and the end of the new state
+void    segmentDue(int next);           // alarm: next timed segment of the state begins
+void    stateDue(int next);             // alarm: timed state is over
+void    gameTask();                     // task: alarms, state machine, sound and light
+void    taskRates();                    // polls fast only in the states that read the player
+void    displayTask();                  // task: draws the game status on the OLED
+void    displaySendTask();              // task: sends the OLED frame a chunk at a time
+#ifdef TASKS_TELEMETRY
+void    telemetryTask();                // task: scheduler, I2C, ping and idle statistics to serial
+#endif
 void    printStatus();                  // debugging print key global variables
 
 char  	strOut[96];             // debugging string to print to OLED and/or serial, not used for game
@@ -21,7 +58,8 @@ char  	strOut[96];             // debugging string to print to OLED and/or seria
 int     timeEntry       = 0;    // holds time reading taken upon state change
 int     timeInState     = 0;    // holds time since entering state
 int     timeSpan[9]     = {0};  // for time regulated states, use timeSpan[STATUS]
-                                // timespan values are set in state machine
+                                // timespan values are set on entry in scheduleState()
+int     segment         = 0;    // timed segment of the current state, advanced by alarms
 
 int     transition      = 0;    // count of state transitions; only resets at power off
 
@@ -32,6 +70,11 @@ int     levelChanged    = 0;    // flag: high if level changed since last cycle
 
 int     activeSensor    = 0;    // sensor whose input was successfully logged
 
+int     displaySending  = FALSE;    // flag: an OLED frame is still being sent
+
+int     sensorsTaskId, gameTaskId, lightTaskId;     // tasks whose rates follow the state, see taskRates()
+int     quiet           = FALSE;    // flag: the current state runs the tasks at TASK_QUIET_US
+
 enum    { 
           initialization        // 0: welcome, simply cycles RGB awaiting user input, plays a little lively tune
         , selection             // 1: level selection, optional, controlled by encoder
@@ -61,12 +104,23 @@ sensor_t sensor = none;         // initialize sensor variable
 
     //      - sound() & light functions direct output subfunctions based on status, passing parameters: time, level, transition, etc
 
+    //      - timed states register their segment boundaries and their end as alarms on entry,
+    //          so the loop only compares the next deadline instead of re-evaluating every time span
+
+    //      - the loop only runs tasks (see TASK_*_US) and sleeps until the next one is released;
+    //          each task runs to completion and never waits for anything
+
+    //      - sensors and game run at 1 kHz only while the player is read; the quiet states run them slower
+    //          and release the game at its next alarm, so the core sleeps through them
+
 
 
 int main(void) {
 
 	BOARD_Init();           // initialize HAL framework, serial clocks & pins, LEDs & Big Blue Button
 
+    OledInit();             // blank the display before the IMU shares the bus, see displayTask()
+
     SENSORS_Init();         // initialize sensor components
 
     LIGHT_Init();           // initialize PWMs for the RGB LEDs
@@ -79,29 +133,117 @@ int main(void) {
 
     timeEntry = TIMERS_GetMilliSeconds();   // initial state entry time
 
-        HAL_Delay(3000);                                // diagnostic: give serial client moment to open
-        printf("\n\nNotBopIt initialized.\n\n");        // diagnostic: initialization announcement
+        printf("\n\nNotBopIt initialized in %d ms.\n\n", timeEntry);   // diagnostic: time to first frame
 
-    transitionTo(initialization);
+    // lower priority runs first when several tasks are due
+    sensorsTaskId = TASKS_Add("sensors", SENSORS_Service, TASK_SENSORS_US, 0);   // IMU bring-up and sampling, ping, encoder
+    gameTaskId    = TASKS_Add("game",    gameTask,        TASK_GAME_US,    1);
+    lightTaskId   = TASKS_Add("light",   updateRGBLED,    TASK_LIGHT_US,   2);
+    TASKS_Add("display",   displayTask,     TASK_DISPLAY_US,   3);
+    TASKS_Add("oled",      displaySendTask, TASK_OLED_US,      4);
+#ifdef TASKS_TELEMETRY
+    TASKS_Add("telemetry", telemetryTask,   TASK_TELEMETRY_US, 5);
+#endif
+
+    transitionTo(initialization);           // sets the task rates of the first state
 
 	while (TRUE) {
 
-        timeInState = TIMERS_GetMilliSeconds() - timeEntry;         // update timeInState regularly
+        if ( !TASKS_Run() ) { IDLE_Until(TASKS_NextDeadline()); }  // sleep until an interrupt or the next release
+
+	}
+
+}
 
-        levelChanged = checkLevelChange(level);                     // flag: check if level was changed since last cycle
+void gameTask() {
 
-        state();                                                    // work on state machine
+    ALARM_Service();                                            // advance timed segments and states when due
 
-		soundAndLight();                                            // work on sounds and lights
+    sensorPingSchedule(status == indication || status == response, sensor);    // ping only when it matters
 
-        levelChanged = FALSE;                                       // reset flag at end of cycle
+    timeInState = TIMERS_GetMilliSeconds() - timeEntry;         // update timeInState regularly
 
-        updateRGBLED();
+    levelChanged = checkLevelChange(level);                     // flag: check if level was changed since last cycle
 
-	}
+    state();                                                    // work on state machine
+
+    soundAndLight();                                            // work on sounds and lights
+
+    levelChanged = FALSE;                                       // reset flag at end of cycle
+
+    uint32_t due;
+    if ( quiet && ALARM_NextDeadline(&due) == SUCCESS ) {      // run again when the next segment begins
+        TASKS_ReleaseBy(gameTaskId, TIMERS_GetMicroSeconds() + (int32_t)(due - TIMERS_GetMilliSeconds()) * 1000);
+    }
 
 }
 
+// taskRates() runs sensors and game at 1 kHz while the player is read or timed; the initialization,
+// abortion and lose states only change on alarms or wait for a press, so 50 Hz polling is plenty
+void taskRates() {
+
+    quiet = (status == initialization || status == abortion || status == lose);
+
+    TASKS_SetPeriod(sensorsTaskId, quiet ? TASK_SENSORS_QUIET_US : TASK_SENSORS_US);
+    TASKS_SetPeriod(gameTaskId,    quiet ? TASK_QUIET_US         : TASK_GAME_US);
+    TASKS_SetPeriod(lightTaskId,   quiet ? TASK_QUIET_US         : TASK_LIGHT_US);
+
+}
+
+// displayTask() redraws only when the game status changed and the last frame is out,
+// a whole frame goes out in 68 chunk sender runs, about 140 ms
+void displayTask() {
+
+    static int shown = -1;
+    int showing = (status << 16) | (level << 8) | trial;
+
+    if ( displaySending || showing == shown ) { return; }
+
+    sprintf(strOut, "NotBopIt\nstate %d\nlevel %d trial %d", status, level, trial);
+    OledClear(OLED_COLOR_BLACK);
+    OledDrawString(strOut);
+    OledStartUpdate();
+    displaySending = TRUE;
+    shown = showing;
+
+}
+
+void displaySendTask() { if ( displaySending ) { displaySending = !OledUpdateService(); } }
+
+#ifdef TASKS_TELEMETRY
+// telemetryTask() prints one report per run, so a whole round takes about a second of runs;
+// each run still blocks for one line (~8 ms), see TASKS_TELEMETRY
+void telemetryTask() {
+
+    static int report = 0;
+    int tasks = TASKS_Count();
+    task_stats_t t;
+    I2C_Stats_t s;
+
+    if ( report < tasks ) {
+        TASKS_GetStats(report, &t);
+        printf("task %-9s runs %lu overruns %lu skipped %lu exec %lu/%lu us late %lu us\n", t.name,
+               (unsigned long)t.runs, (unsigned long)t.overruns, (unsigned long)t.skipped,
+               (unsigned long)t.exec_avg, (unsigned long)t.exec_max, (unsigned long)t.late_max);
+    } else if ( report < tasks + 2 ) {
+        unsigned char address = (report == tasks) ? BNO055_ADDRESS_A : DISPLAY_ADDRESS;
+        if ( I2C_GetStats(address, &s) == SUCCESS ) {
+            printf("i2c 0x%02X transfers %lu errors %lu timeouts %lu retries %lu recoveries %lu\n", address,
+                   (unsigned long)s.transfers, (unsigned long)s.errors, (unsigned long)s.timeouts,
+                   (unsigned long)s.retries, (unsigned long)s.recoveries);
+        }
+    } else if ( report == tasks + 2 ) {
+        printf("ping rate %u Hz latency %u us timeouts %lu\n", PING_GetRate(), PING_GetLatency(),
+               (unsigned long)PING_GetTimeouts());
+    } else {
+        printf("idle %d%% wake latency %lu/%lu us\n", IDLE_Percent(),
+               (unsigned long)IDLE_WakeLatency(), (unsigned long)IDLE_WakeLatencyMax());
+    }
+    report = (report + 1) % (tasks + 4);
+
+}
+#endif
+
 void printStatus() {
 
     printf("\nprintStatus:: \ttimeEntry: %d status: %d level: %d trial: %d sensor: %d\n\n", timeEntry, status, level, trial, sensor);
@@ -130,10 +272,44 @@ void transitionTo ( int newState) {             // controls transition between s
         sensor = selectSensor();
     }
 
+    scheduleState();
+
+    taskRates();
+
 }
 
-// timeElapsed() returns TRUE if the time elapsed is longer than the time submitted
-int timeElapsed ( int presentTime) { return ( timeInState >= presentTime ) ; }
+// scheduleState() sets the time span of the entered state and registers its deadlines:
+// segment k begins at timeSpan * k / parts, and timed states end by moving on to the next state
+void scheduleState() {
+
+    int parts = 0, last = 0, next = -1;     // segments 1 to last of parts, next state, if timed
+
+    ALARM_CancelAll();                      // deadlines of the previous state no longer apply
+    segment = 0;
+
+    if      (status == initialization)  { timeSpan[initialization] = 1500;            parts = 3; last = 3; }       // three half second tones
+    else if (status == selection)       { timeSpan[selection]      = 333;                                  }       // single short tone upon level change
+    else if (status == introduction)    { timeSpan[introduction]   = 1500;            parts = 3; last = 2; }       // three half seconds
+    else if (status == abortion)        { timeSpan[abortion]       = 3000;            parts = 3; last = 2; next = initialization; }  // three one second actions
+    else if (status == indication)      { timeSpan[indication]     = 1000;                       next = response;       }  // one second of tone and RGB
+    else if (status == response)        { timeSpan[response]       = ((LEVELS - level + 1) * 1000) / 2; next = lose;    }  // time limit shrinks per level
+    else if (status == lose)            { timeSpan[lose]           = 9000;            parts = 9; last = 8; next = initialization; }
+    else if (status == levelup)         { timeSpan[levelup]        = level * 1000;               next = (level <= LEVELS) ? indication : win; }
+    else if (status == win)             { timeSpan[win]            = LEVELS * 1000;              next = initialization; }
+
+    for (int k = 1; k <= last; k++) { ALARM_Set(timeSpan[status] * k / parts, 0, segmentDue, k); }
+    if (next >= 0)                  { ALARM_Set(timeSpan[status], 0, stateDue, next); }
+
+}
+
+void segmentDue(int next) { segment = next; }
+
+void stateDue(int next) {
+
+    if (next == initialization) { trial = 0; level = 0; }      // every timed way back to the start begins a new game
+    transitionTo(next);
+
+}
 
 // selectSensor() acquires a random value with a range from 1:7
 int selectSensor() {
@@ -152,16 +328,16 @@ void state() {
 
     if          (status == initialization)  {
 
-        timeSpan[initialization] = 1500;    // three half second tones
-
             // printf("\nQEI_GetPosition:%d", QEI_GetPosition());  // diagnostic: raw encoder
         
         if      ( encoderChangeCW() ) { transitionTo(selection);    }
         else if ( captouchPressed() ) { transitionTo(introduction); }
 
-    } else if   (status == selection)       {
+        // the flash erase stalls everything for 1-2 s, input included, so save only once the
+        // colour wheel has run a while with nobody playing; a press during the stall is lost
+        else if ( segment >= 3 && timeInState >= CALIB_SAVE_IDLE_MS ) { sensorSaveCalibration(); }
 
-        timeSpan[selection] = 333;      // single short tone upon level change
+    } else if   (status == selection)       {
 
         // alter level per turn of encoder
         if      ( encoderChangeCW()  && level <= LEVELS ) { level++; }
@@ -171,55 +347,29 @@ void state() {
 
     } else if   (status == introduction)    {
 
-        timeSpan[introduction] = 1500;      // three half seconds
-
         if      ( captouchHeld(LONG_PRESS * 3) ) { transitionTo(indication); }
         else if ( captouchReleased()           ) { transitionTo(abortion  );  }
 
     } else if   (status == abortion)        {
 
-        timeSpan[abortion] = 3000;          // three one second actions
-
-        if      ( timeElapsed(timeSpan[abortion]) )   { transitionTo(initialization);                       trial = 0; level = 0; }
+        // ends by alarm after timeSpan[abortion], see scheduleState()
 
     } else if   (status == indication)      {
 
-        timeSpan[indication] = 1000;        // the player is offered one second of tone and RGB to indicate interactive sensor
-
-        if      ( timeElapsed(timeSpan[indication]) )   { transitionTo(response); }
+        // the player is offered one second of tone and RGB, then the response state follows by alarm
 
     } else if   (status == response)        {
 
-        activeSensor = sensorActivated(sensor);
+        activeSensor = sensorActivated(sensor);         // the time limit is an alarm moving on to lose
 
-        if      ( timeElapsed( ((LEVELS - level + 1) * 1000) / 2) )           { transitionTo(lose); }
-        else if ( activeSensor ) { // THIS SHOULD BE AN ELSE-IF FOR TIME CONSTRAINT 
+        if      ( activeSensor ) {
             if ( activeSensor == sensor ) {                                                                 trial++;
                 if ( trial <= TRIALS )        { transitionTo(indication);                                               }
-                if ( trial >  TRIALS )        { transitionTo(levelup);                                      trial = 0; level++; printf("\n\n=== LEVEL UP ===\n\n");}
+                if ( trial >  TRIALS )        { trial = 0; level++; printf("\n\n=== LEVEL UP ===\n\n");   transitionTo(levelup); }
             } else                            { transitionTo(lose); }
         }
 
-    } else if   (status == lose)            {
-
-        timeSpan[lose] = 9000;
-
-        if      ( timeElapsed(timeSpan[lose]) )   { transitionTo(initialization);                           trial = 0; level = 0; }
-        
-    } else if   (status == levelup)         {
-
-        timeSpan[levelup] = level*1000;
-
-        if      ( timeElapsed(timeSpan[levelup]) && level<=LEVELS ) { transitionTo(indication); }
-        else if ( timeElapsed(timeSpan[levelup]) && level>LEVELS) { transitionTo(win); }
-
-    } else if   (status == win)             {
-
-        timeSpan[win] = LEVELS*1000;
-
-        if      ( timeElapsed(timeSpan[win])) { transitionTo(initialization);                               trial = 0; level = 0; }
-
-    }
+    }                                   // lose, levelup and win only wait for their alarms
 
 }
 
@@ -227,8 +377,8 @@ void state() {
 // - below contents should call upon functions from sound.c/.h and light.c/.h
 // - timing dependent output should rely in relation with timeSpan[status]
 
-// use variables timeInState, timeSpan[status], transition level to control RGB & speaker
-//  timeInState: time in current state [ms]
+// use variables segment, timeSpan[status], transition level to control RGB & speaker
+//  segment: timed segment of the current state, advanced by alarms set in scheduleState()
 //  timeSpan[status]: relative time constant [ms] for state cycle, selected using enum
 //  transition: incrementing state transition counter, only resets at power off
 
@@ -238,10 +388,10 @@ void soundAndLight() {
         // upon entry, speaker plays 3 ascending upbeat tones for half second each
         //  then rgb slowly cycles color wheel indefinitely awaiting user input
 
-        if      ( timeInState < (timeSpan[initialization] * 1 / 3 ) ) { playTone(100);}
-        else if ( timeInState < (timeSpan[initialization] * 2 / 3 ) ) { playTone(200);}
-        else if ( timeInState < (timeSpan[initialization]         ) ) { playTone(300);}
-        else if ( timeInState > (timeSpan[initialization]         ) ) { continuousColorWheel(5000);}
+        if      ( segment < 1 ) { playTone(100);}
+        else if ( segment < 2 ) { playTone(200);}
+        else if ( segment < 3 ) { playTone(300);}
+        else                    { continuousColorWheel(5000);}
 
     }
     else if (status == selection)       {
@@ -260,9 +410,9 @@ void soundAndLight() {
         // reminiscent of a racing game starting sequence
         // initial level is low-tone dim-green, final level is high-tone bright-green
 
-        if      ( timeInState < (timeSpan[introduction] * 1 / 3 ) ) { playTone(400);  colorInDegrees(300); brightness(33) ;}
-        else if ( timeInState < (timeSpan[introduction] * 2 / 3 ) ) { playTone(800);  colorInDegrees(300); brightness(66) ;}
-        else if ( timeInState < (timeSpan[introduction]         ) ) { playTone(1200); colorInDegrees(300); brightness(100);}
+        if      ( segment < 1 ) { playTone(400);  colorInDegrees(300); brightness(33) ;}
+        else if ( segment < 2 ) { playTone(800);  colorInDegrees(300); brightness(66) ;}
+        else                    { playTone(1200); colorInDegrees(300); brightness(100);}
 
     }
     else if (status == abortion)        {
@@ -270,9 +420,9 @@ void soundAndLight() {
         //  then two descending 1 second low tones are played
         //   for a total of 3 seconds
 
-        if      ( timeInState < (timeSpan[abortion] * 1 / 3 ) ) { soundOff();    brightness(100); colorInDegrees(60); }
-        else if ( timeInState < (timeSpan[abortion] * 2 / 3 ) ) { playTone(800); brightness(0); }
-        else if ( timeInState < (timeSpan[abortion]         ) ) { playTone(400); brightness(0); }
+        if      ( segment < 1 ) { soundOff();    brightness(100); colorInDegrees(60); }
+        else if ( segment < 2 ) { playTone(800); brightness(0); }
+        else                    { playTone(400); brightness(0); }
 
     }
     else if (status == indication)      {
@@ -296,12 +446,12 @@ void soundAndLight() {
         //  RGB fades to off over 2 seconds
         //  device is dark for 3 seconds
 
-        if      ( timeInState < (timeSpan[lose] * 1 / 9 ) ) { soundOff();    brightness(100); color(100,100,100); }
-        else if ( timeInState < (timeSpan[lose] * 2 / 9 ) ) { playTone(300); brightness(100); color(100,100,100); }
-        else if ( timeInState < (timeSpan[lose] * 3 / 9 ) ) { playTone(200); brightness(100); color(100,100,100); }
-        else if ( timeInState < (timeSpan[lose] * 4 / 9 ) ) { playTone(100); brightness(100); color(100,100,100); }
-        else if ( timeInState < (timeSpan[lose] * 6 / 9 ) ) { soundOff();    brightnessFade(100, 0, (timeSpan[lose] * 2 / 9 ), transition); }
-        else if ( timeInState < (timeSpan[lose]         ) ) { soundOff();    brightness(0); }
+        if      ( segment < 1 ) { soundOff();    brightness(100); color(100,100,100); }
+        else if ( segment < 2 ) { playTone(300); brightness(100); color(100,100,100); }
+        else if ( segment < 3 ) { playTone(200); brightness(100); color(100,100,100); }
+        else if ( segment < 4 ) { playTone(100); brightness(100); color(100,100,100); }
+        else if ( segment < 6 ) { soundOff();    brightnessFade(100, 0, (timeSpan[lose] * 2 / 9 ), transition); }
+        else                    { soundOff();    brightness(0); }
     }
     else if (status == levelup)         {
         // speaker plays 3 upbeat ascending tones one second each
@@ -309,9 +459,7 @@ void soundAndLight() {
 
         continuousColorWheel(level*100);
 
-        if      ( timeInState < (timeSpan[levelup] * 1      ) ) { playTone(300); }
-        else if ( timeInState < (timeSpan[levelup] * 2      ) ) { playTone(600); }
-        else if ( timeInState < (timeSpan[levelup] * 3 / 9  ) ) { playTone(900); }
+        playTone(300);                      // the state ends by alarm after timeSpan[levelup]
 
     }
     else if (status == win)             {
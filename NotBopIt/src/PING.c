@@ -12,16 +12,52 @@
 
  #include "PING.h"
 
- #define VELOCITY 34
- // speed of sound in air = 340m/s = 0.34mm/us
- // to avoid using floats, use 34 and divide by 100 in the calculation in PING_GetDistance()
+ // speed of sound in air = 331.3 + 0.6 * T m/s, kept in 0.1 m/s so the
+ // distance in mm is flight time [us] * c10 / 20000 (there and back)
+ #define C10_AT_0C     3313
+ #define C10_PER_C     6
+ #define DISTANCE_MM(us) (((us) * speed_c10) / 20000)
  
- enum State {TRIGGER, WAIT}; // state machine states
- static volatile enum State state =  WAIT;
- 
- static volatile uint32_t rise_time = 0, fall_time = 0; // for recording edge times of echo signal
- static volatile uint8_t echo_received = FALSE;
- static unsigned int flight_time = 0, distance = 0;
+ // echo pin, TIM2_CH1 capturing both edges
+ #define ECHO_PORT GPIOA
+ #define ECHO_PIN  GPIO_PIN_15
+
+ // trigger pin PB8 (PWM_5 on shield), TIM10_CH1 in one-pulse mode
+ #define TRIGGER_PORT GPIOB
+ #define TRIGGER_PIN  GPIO_PIN_8
+ #define TRIGGER_US   10          // HC-SR04 needs at least 10 us high
+
+ static TIM_HandleTypeDef htim10;
+
+ static uint32_t rise_time = 0;                // [us] of the last rising echo edge, ISR only
+ static uint8_t rise_seen = FALSE;            // ignore a falling edge without its rising edge
+ static volatile uint32_t echo_width = 0;     // [us] last complete echo, one word so reads never tear
+ static volatile uint32_t echo_count = 0;
+
+ static volatile uint8_t mode = PING_OFF;
+ static volatile uint8_t waiting = FALSE;     // trigger sent, echo not yet complete
+ static volatile uint32_t trigger_time = 0;   // [us] of the last trigger
+ static volatile uint32_t latency = 0;        // [us] trigger to distance of the last echo
+ static uint32_t timeouts = 0;
+ static uint32_t window_start = 0, window_count = 0;   // pings/s bookkeeping
+ static unsigned int rate = 0;
+
+ // filter state, super-loop only
+ static uint32_t speed_c10 = C10_AT_0C + C10_PER_C * 20;  // assume 20 C until told otherwise
+ static uint32_t seen_count = 0;                          // echo_count already filtered
+ static struct {
+     uint16_t distance;  // [mm]
+     uint8_t  valid;     // FALSE for lost or out-of-range echoes
+ } window[PING_MEDIAN_N];
+ static uint8_t  window_next = 0;
+ static uint16_t filtered = 0;       // [mm] median of the valid samples
+ static uint8_t  filtered_valid = FALSE;
+ static uint32_t filtered_time = 0;  // [us] when filtered was last updated
+ static int      velocity = 0;       // [mm/s], positive approaching
+
+ static void trigger(uint32_t now);
+ static void filterSample(uint32_t width, uint8_t valid, uint32_t now);
+ static void filterReset(void);
  
  
  /**
@@ -33,13 +69,7 @@
   */
  unsigned int PING_GetDistance(void)
  {
-    if(echo_received)
-    {
-        flight_time = fall_time - rise_time;
-        echo_received = FALSE;
-    }
-    distance = (flight_time * VELOCITY) / 200;
-     return distance;
+     return DISTANCE_MM(echo_width);
  }
  
  /**
@@ -50,113 +80,285 @@
   */
  unsigned int PING_GetTimeofFlight(void)
  {
-     if(echo_received)
-     {
-         flight_time = fall_time - rise_time;
-         echo_received = FALSE;
+     return echo_width;
+ }
+ 
+ /**
+  * @function    PING_GetEchoCount(void)
+  * @brief       Number of echo pulses measured so far.
+  * @return      echo count
+  */
+ uint32_t PING_GetEchoCount(void)
+ {
+     return echo_count;
+ }
+ 
+ /**
+  * @function    PING_SetMode(uint8_t newMode)
+  * @brief       PING_OFF, PING_NORMAL (every PING_INTERVAL_US) or PING_BOOST
+  *              (re-trigger as soon as the echo is back, at most every PING_MIN_CYCLE_US)
+  */
+ void PING_SetMode(uint8_t newMode)
+ {
+     if (newMode <= PING_BOOST) {
+         if (mode == PING_OFF && newMode != PING_OFF) {
+             filterReset();                     // samples from before the pause are stale
+         }
+         mode = newMode;
      }
-     return flight_time;
  }
  
+ uint8_t PING_GetMode(void)
+ {
+     return mode;
+ }
+ 
+ /**
+  * @function    PING_Service(void)
+  * @brief       Sends the next trigger when it is due and keeps the rate statistics.
+  *              Call every loop.
+  */
+ void PING_Service(void)
+ {
+     uint32_t now = TIMERS_GetMicroSeconds();
+ 
+     // pings/s over the last whole second
+     if (now - window_start >= 1000000) {
+         rate = echo_count - window_count;
+         window_count = echo_count;
+         window_start = now;
+     }
+ 
+     // one filter step per new echo
+     if (echo_count != seen_count) {
+         uint32_t width = echo_width;
+         seen_count = echo_count;
+         filterSample(width, width >= PING_MIN_ECHO_US && width <= PING_MAX_ECHO_US, now);
+     }
+ 
+     if (mode == PING_OFF) {
+         return;
+     }
+ 
+     uint8_t lost = FALSE;
+     __disable_irq();                           // the echo ISR may trigger as well
+     now = TIMERS_GetMicroSeconds();
+     if (waiting && now - trigger_time >= PING_TIMEOUT_US) {
+         waiting = FALSE;                       // no echo, the sensor gave up
+         lost = TRUE;
+     }
+     if (!waiting && now - trigger_time >= ((mode == PING_BOOST) ? PING_MIN_CYCLE_US : PING_INTERVAL_US)) {
+         trigger(now);
+     }
+     __enable_irq();
+ 
+     if (lost) {
+         timeouts++;
+         filterSample(0, FALSE, now);
+     }
+ }
+ 
+ /**
+  * @function    PING_GetRate(void)
+  * @brief       Echoes measured during the last whole second.
+  * @return      pings/s
+  */
+ unsigned int PING_GetRate(void)
+ {
+     return rate;
+ }
+ 
+ /**
+  * @function    PING_GetLatency(void)
+  * @brief       Time from the trigger to the end of its echo, when the distance is available.
+  * @return      latency in uSec
+  */
+ unsigned int PING_GetLatency(void)
+ {
+     return latency;
+ }
  
- //Sets up both the timer extrenal interrupt peripherals along with their
- //Also configures PWM_5 as a GPIO output for the trigger pin. 
+ uint32_t PING_GetTimeouts(void)
+ {
+     return timeouts;
+ }
+ 
+ /**
+  * @function    PING_SetTemperature(int celsius)
+  * @brief       Air temperature for the speed of sound, 20 C by default.
+  */
+ void PING_SetTemperature(int celsius)
+ {
+     speed_c10 = C10_AT_0C + C10_PER_C * celsius;
+ }
+ 
+ /**
+  * @function    PING_GetFilteredDistance(void)
+  * @brief       Median of the valid samples among the last PING_MEDIAN_N echoes.
+  * @return      distance in mm, the last good value while PING_IsValid() is FALSE
+  */
+ unsigned int PING_GetFilteredDistance(void)
+ {
+     return filtered;
+ }
+ 
+ uint8_t PING_IsValid(void)
+ {
+     return filtered_valid;
+ }
+ 
+ int PING_GetVelocity(void)
+ {
+     return filtered_valid ? velocity : 0;
+ }
+ 
+ 
+ //Sets up the trigger (TIM10 one-pulse on PB8) and echo capture (TIM2 on PA15)
+ //peripherals. Pinging starts with PING_SetMode().
  char PING_Init(void) {
      // init other libraries
      BOARD_Init();
      TIMER_Init();
  
-     // this block initializes the GPIO output pin (PB8, PWM_5 on shield)
+     // this block routes the trigger pin (PB8, PWM_5 on shield) to TIM10_CH1
      GPIO_InitTypeDef GPIO_InitStruct = {0};
-     GPIO_InitStruct.Pin = GPIO_PIN_8;
-     GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+     __HAL_RCC_GPIOB_CLK_ENABLE();
+     GPIO_InitStruct.Pin = TRIGGER_PIN;
+     GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
      GPIO_InitStruct.Pull = GPIO_NOPULL;
      GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
- 
-     // this block inits the timer generated interrupt
-     TIM_ClockConfigTypeDef sClockSourceConfig = {0};
-     TIM_MasterConfigTypeDef sMasterConfig = {0};
-     htim3.Instance = TIM3;
-     htim3.Init.Prescaler = 83; // divide by 1 prescaler (84-1) = 1 Mhz tick
-     htim3.Init.CounterMode = TIM_COUNTERMODE_UP;
-     htim3.Init.Period = 59999; // period of (number of clock cycles between) interrupts
-     htim3.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
-     htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
-     if (HAL_TIM_Base_Init(&htim3) != HAL_OK)
+     GPIO_InitStruct.Alternate = GPIO_AF3_TIM10;
+     HAL_GPIO_Init(TRIGGER_PORT, &GPIO_InitStruct);
+ 
+     // this block inits TIM10 to output one TRIGGER_US pulse each time it is enabled:
+     // PWM mode 2 is low below the compare value and high from it up to the reload
+     TIM_OC_InitTypeDef sConfigOC = {0};
+     __HAL_RCC_TIM10_CLK_ENABLE();
+     htim10.Instance = TIM10;
+     htim10.Init.Prescaler = 83; // divide by 1 prescaler (84-1) = 1 Mhz tick
+     htim10.Init.CounterMode = TIM_COUNTERMODE_UP;
+     htim10.Init.Period = TRIGGER_US;
+     htim10.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+     htim10.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+     if (HAL_TIM_PWM_Init(&htim10) != HAL_OK)
+     {
+         return ERROR;
+     }
+     sConfigOC.OCMode = TIM_OCMODE_PWM2;
+     sConfigOC.Pulse = 1;
+     sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+     sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+     if (HAL_TIM_PWM_ConfigChannel(&htim10, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
      {
          return ERROR;
      }
-     sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
-     if (HAL_TIM_ConfigClockSource(&htim3, &sClockSourceConfig) != HAL_OK)
+     TIM10->CR1 |= TIM_CR1_OPM;    // counter stops at the update, the output rests low
+     TIM10->CCER |= TIM_CCER_CC1E; // enable the output without starting the counter
+ 
+     // this block routes the echo pin (PA15) to TIM2_CH1, capturing both edges
+     // against the 1 MHz microsecond timebase
+     TIM_IC_InitTypeDef sConfigIC = {0};
+     __HAL_RCC_GPIOA_CLK_ENABLE();
+     GPIO_InitStruct.Pin = ECHO_PIN;
+     GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+     GPIO_InitStruct.Pull = GPIO_NOPULL;
+     GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+     GPIO_InitStruct.Alternate = GPIO_AF1_TIM2;
+     HAL_GPIO_Init(ECHO_PORT, &GPIO_InitStruct);
+
+     sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
+     sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+     sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+     sConfigIC.ICFilter = 0x3; // 8 samples at 84 MHz, rejects glitches under ~0.1 us
+     if (HAL_TIM_IC_ConfigChannel(&htim2, &sConfigIC, TIM_CHANNEL_1) != HAL_OK)
      {
          return ERROR;
      }
-     sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
-     sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
-     if (HAL_TIMEx_MasterConfigSynchronization(&htim3, &sMasterConfig) != HAL_OK)
+     if (HAL_TIM_IC_Start_IT(&htim2, TIM_CHANNEL_1) != HAL_OK)
      {
          return ERROR;
      }
-     HAL_TIM_Base_Start_IT(&htim3); // start interrupt
- 
-     // this block inits the external pin-generted interrupt on any change of pin PC0
-     GPIO_InitStruct.Pin = GPIO_PIN_0;
-     GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
-     GPIO_InitStruct.Pull = GPIO_NOPULL;
-     HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
-     HAL_NVIC_SetPriority(EXTI0_IRQn, 0, 0);
-     HAL_NVIC_EnableIRQ(EXTI0_IRQn);
  
      return SUCCESS;
  }
  
-  // external interrupt ISR for pin PC0,
-  // used to record the state of the sensor's Echo pin
-  // This interrupt is triggered on both the rising and falling edges of the Echo pin.
- 
-  void EXTI0_IRQHandler(void) {
-     // EXTI line interrupt detected 
-     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_0) != RESET) {
-         __HAL_GPIO_EXTI_CLEAR_IT(GPIO_PIN_0); // clear interrupt flag
-  
-         // PING sensor echo detection logic
-         if(HAL_GPIO_ReadPin(GPIOC, GPIO_PIN_0)){  // If a rising edge was detected,
-             rise_time = TIMERS_GetMicroSeconds(); // record the microsecond time.
+  // TIM2 capture callback, used to time the sensor's Echo pin.
+  // The counter latches the edge in hardware; the pin is read only to tell
+  // which edge it was, which is safe since echoes last at least ~100 us.
+ 
+  void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim) {
+     if (htim == &htim2 && htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1) {
+         uint32_t time = TIMERS_CaptureToMicroSeconds(HAL_TIM_ReadCapturedValue(htim, TIM_CHANNEL_1));
+ 
+         if (HAL_GPIO_ReadPin(ECHO_PORT, ECHO_PIN)) { // If a rising edge was captured,
+             rise_time = time;                        // record the microsecond time.
+             rise_seen = TRUE;
          }
-         else {                                    // Otherwise, a falling edge was detected;
-             fall_time = TIMERS_GetMicroSeconds(); // record the microsecond time and
-             echo_received = TRUE;                 // flag that an echo signal was received.
+         else if (rise_seen) {                        // Otherwise, a falling edge was captured;
+             echo_width = time - rise_time;           // publish the pulse width in one store
+             echo_count++;                            // and count it.
+             rise_seen = FALSE;
+             if (waiting) {
+                 latency = time - trigger_time;
+                 waiting = FALSE;
+                 // boosted: ping again right away unless the cycle floor is not yet reached
+                 if (mode == PING_BOOST && time - trigger_time >= PING_MIN_CYCLE_US) {
+                     trigger(TIMERS_GetMicroSeconds());
+                 }
+             }
          }
      }
   }
-   
-  // From Appendix on Timer interrupts:
-  // We can generate an interrupt when the timer reaches some desired value.
-  // This is done at initialization by setting the period field to a value between 0-65535. 
-  // You can also change this value at runtime by modifying the ARR register associated with the timer. 
-  // For example, if we were using TIM3, we would modify the period by doing 
-  // TIM3->ARR = x;  // change the period of TIM3 to x
- 
-  // TIM3 ISR
-  void TIM3_IRQHandler(void) {
-     if (__HAL_TIM_GET_IT_SOURCE(&htim3, TIM_IT_UPDATE) != RESET) {
-         __HAL_TIM_CLEAR_IT(&htim3, TIM_IT_UPDATE); // clear interrupt flag
-   
-         // state machine of your design
- 
-         switch(state)
-         {
-             case(TRIGGER):
-                 HAL_GPIO_WritePin(GPIOB, GPIO_PIN_8, GPIO_PIN_SET); // trigger sensor
-                 TIM3->ARR = 9; // generate interrupt in 10us
-                 state = WAIT;  // switch state machine to WAIT state
-                 break;
-             case(WAIT):
-                 HAL_GPIO_WritePin(GPIOB, GPIO_PIN_8, GPIO_PIN_RESET); // lower trigger pin
-                 TIM3->ARR = 59999; // generate interrupt in 60ms
-                 state = TRIGGER;   // switch state machine to TRIGGER state
-                 break;
+ 
+  // one echo (or lost echo) through the median filter and the velocity estimate
+  static void filterSample(uint32_t width, uint8_t valid, uint32_t now) {
+     uint16_t sorted[PING_MEDIAN_N];
+     uint8_t n = 0, i, j;
+ 
+     window[window_next].distance = valid ? DISTANCE_MM(width) : 0;
+     window[window_next].valid = valid;
+     window_next = (window_next + 1) % PING_MEDIAN_N;
+ 
+     // insertion sort of the valid samples, N is small
+     for (i = 0; i < PING_MEDIAN_N; i++) {
+         if (!window[i].valid) { continue; }
+         for (j = n; j > 0 && sorted[j - 1] > window[i].distance; j--) {
+             sorted[j] = sorted[j - 1];
          }
+         sorted[j] = window[i].distance;
+         n++;
      }
-  }
\ No newline at end of file
+ 
+     // a majority must agree, so single timeouts and multipath spikes fall out of the median
+     if (n <= PING_MEDIAN_N / 2) {
+         filtered_valid = FALSE;
+         velocity = 0;
+         return;
+     }
+ 
+     uint16_t median = sorted[n / 2];
+     if (filtered_valid && now != filtered_time) {
+         int sample = ((int)filtered - (int)median) * 1000 / (int)((now - filtered_time) / 1000 + 1);
+         velocity = (velocity + sample) / 2;    // light smoothing, the median already delays
+     }
+     filtered = median;
+     filtered_time = now;
+     filtered_valid = TRUE;
+  }
+ 
+  static void filterReset(void) {
+     for (uint8_t i = 0; i < PING_MEDIAN_N; i++) {
+         window[i].valid = FALSE;
+     }
+     filtered_valid = FALSE;
+     velocity = 0;
+  }
+ 
+  // starts one trigger pulse, called with the echo interrupt unable to intervene
+  static void trigger(uint32_t now) {
+     if ((TIM10->CR1 & TIM_CR1_CEN) == 0) {
+         TIM10->CR1 |= TIM_CR1_CEN;
+         trigger_time = now;
+         waiting = TRUE;
+     }
+  }
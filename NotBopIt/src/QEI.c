@@ -11,20 +11,45 @@
 
 
 #include "QEI.h"
+#include "timers.h"
 
 
 #define MAX_INCREMENT 96
 
+#if !QEI_HARDWARE
+// QEI_TABLE entry of a transition that skipped a state, both channels changed at once
+#define GLITCH 2
 
-typedef struct {
-    GPIO_PinState old_state;
-    GPIO_PinState new_state;
-} PinState_t;
+// direction of each transition, indexed by (old state << 2) | new state with state = (A << 1) | B;
+// clockwise runs 00 -> 10 -> 11 -> 01 -> 00
+static const int8_t QEI_TABLE[16] = {
+//  new: 00      01      10      11
+         0,     -1,     +1,  GLITCH,   // old 00
+        +1,      0,  GLITCH,     -1,   // old 01
+        -1,  GLITCH,      0,     +1,   // old 10
+    GLITCH,     +1,     -1,      0     // old 11
+};
+#endif
+
+static volatile int32_t count = 0;    // edges accumulated since the last reset, never wraps in practice
+static volatile uint32_t glitches = 0;
+static volatile int position = 0;     // for recording the position in degrees
 
-static volatile PinState_t A = {SET, SET}, B = {SET, SET};
+// edge timing for the velocity estimate
+static volatile uint32_t edge_time = 0;   // [us] of the latest edge
+static volatile uint32_t edge_period = 0; // [us] between the latest edges in one direction, 0 unknown
+static volatile int8_t edge_dir = 0;      // direction of the latest edge, +1 clockwise
+static int velocity = 0;                  // [deg/s]
+static int acceleration = 0;              // [deg/s^2]
 
-static volatile int count = 0;    // ranges from +/- 95 before rolling over to 0
-static volatile int position = 0; // for recording the position in degrees
+#if QEI_HARDWARE
+static TIM_HandleTypeDef htim3;
+static uint16_t last_cnt = 0;         // TIM3 counter at the previous update
+static void QEI_Update(void);
+#else
+static volatile uint8_t state = 0x3;  // (A << 1) | B as last seen
+static uint8_t QEI_ReadState(void);
+#endif
 
 /**
  * @function QEI_Init(void)
@@ -35,6 +60,40 @@ static volatile int position = 0; // for recording the position in degrees
 */
 void QEI_Init(void)
 {
+#if QEI_HARDWARE
+    // Route PB4 PB5 to TIM3_CH1 TIM3_CH2
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    __HAL_RCC_GPIOB_CLK_ENABLE();
+    GPIO_InitStruct.Pin = ENC_A|ENC_B;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    GPIO_InitStruct.Alternate = GPIO_AF2_TIM3;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    // TIM3 counts every edge of both channels, up for A leading B (clockwise)
+    TIM_Encoder_InitTypeDef sConfig = {0};
+    __HAL_RCC_TIM3_CLK_ENABLE();
+    htim3.Instance = TIM3;
+    htim3.Init.Prescaler = 0;
+    htim3.Init.CounterMode = TIM_COUNTERMODE_UP;
+    htim3.Init.Period = 0xFFFF;
+    htim3.Init.ClockDivision = TIM_CLOCKDIVISION_DIV4; // filter sampling clock
+    htim3.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+    sConfig.EncoderMode = TIM_ENCODERMODE_TI12;
+    sConfig.IC1Polarity = TIM_ICPOLARITY_RISING;
+    sConfig.IC1Selection = TIM_ICSELECTION_DIRECTTI;
+    sConfig.IC1Prescaler = TIM_ICPSC_DIV1;
+    sConfig.IC1Filter = QEI_FILTER;
+    sConfig.IC2Polarity = TIM_ICPOLARITY_RISING;
+    sConfig.IC2Selection = TIM_ICSELECTION_DIRECTTI;
+    sConfig.IC2Prescaler = TIM_ICPSC_DIV1;
+    sConfig.IC2Filter = QEI_FILTER;
+    if (HAL_TIM_Encoder_Init(&htim3, &sConfig) == HAL_OK) {
+        HAL_TIM_Encoder_Start(&htim3, TIM_CHANNEL_ALL);
+    }
+    QEI_ResetPosition();
+#else
     // Configure GPIO pins : PB4 PB5 
     GPIO_InitTypeDef GPIO_InitStruct = {0};
     GPIO_InitStruct.Pin = GPIO_PIN_4|GPIO_PIN_5;
@@ -47,8 +106,8 @@ void QEI_Init(void)
     HAL_NVIC_EnableIRQ(EXTI4_IRQn);
     HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
- 
-    // the rest of the function goes here
+    QEI_ResetPosition();
+#endif
 }
 
 
@@ -59,10 +118,97 @@ void QEI_Init(void)
 */
 int QEI_GetPosition(void)
 {
-    position = count * 360 / MAX_INCREMENT;
+#if QEI_HARDWARE
+    QEI_Update();
+#endif
+    position = (count % MAX_INCREMENT) * 360 / MAX_INCREMENT;
     return position;
 }
 
+/**
+ * @function QEI_GetCount(void)
+ * @param none
+ * @brief  Edges counted since the last reset, MAX_INCREMENT per revolution, without rolling over.
+ * @return accumulated count
+*/
+int32_t QEI_GetCount(void)
+{
+#if QEI_HARDWARE
+    QEI_Update();
+#endif
+    return count;
+}
+
+/**
+ * @function QEI_GetGlitches(void)
+ * @param none
+ * @brief  Transitions on which both channels changed at once, so a state was missed and the
+ *         edge could not be counted. Always 0 with QEI_HARDWARE, the timer does not report them.
+ * @return glitch count
+*/
+uint32_t QEI_GetGlitches(void)
+{
+    return glitches;
+}
+
+/**
+ * @function QEI_Service(void)
+ * @param none
+ * @brief  Updates the velocity and acceleration estimates every QEI_WINDOW_US. Call every loop.
+ * @return none
+*/
+void QEI_Service(void)
+{
+    static uint32_t window_start = 0;
+    static int32_t window_count = 0;
+    uint32_t now = TIMERS_GetMicroSeconds();
+    uint32_t elapsed = now - window_start;
+    uint32_t time, period, since;
+    int32_t delta;
+    int8_t dir;
+    int v;
+
+#if QEI_HARDWARE
+    QEI_Update();                         // timestamps the edges seen since the last call
+#endif
+    if (elapsed < QEI_WINDOW_US) {
+        return;
+    }
+    delta = count - window_count;
+
+    if (delta >= QEI_FAST_EDGES || delta <= -QEI_FAST_EDGES) {
+        // fast: edges per window
+        v = (int)((int64_t)delta * 1000000 / elapsed);
+    } else {
+        // slow: one edge period, stretched by the time already waited for the next edge
+        __disable_irq();
+        time = edge_time; period = edge_period; dir = edge_dir;
+        __enable_irq();
+        since = now - time;
+        if (dir == 0 || period == 0 || since > QEI_STOP_US) {
+            v = 0;
+        } else {
+            v = dir * (int)(1000000 / ((since > period) ? since : period));
+        }
+    }
+    v = v * 360 / MAX_INCREMENT;          // edges/s to degrees/s
+
+    acceleration = (acceleration + (int)((int64_t)(v - velocity) * 1000000 / elapsed)) / 2;
+    velocity = v;
+    window_start = now;
+    window_count += delta;
+}
+
+int QEI_GetVelocity(void)
+{
+    return velocity;
+}
+
+int QEI_GetAcceleration(void)
+{
+    return acceleration;
+}
+
 
 /**
  * @Function QEI_ResetPosition(void) 
@@ -76,61 +222,65 @@ void QEI_ResetPosition()
     // QEI_ResetPosition() should reset the count (module variable) and the state of the QEI state machine
 
     count = 0;
-    A.new_state = SET; A.old_state = SET;
-    B.new_state = SET; B.old_state = SET;
+#if QEI_HARDWARE
+    last_cnt = TIM3->CNT;
+#else
+    state = QEI_ReadState();
+#endif
 }
 
+#if QEI_HARDWARE
+// Folds the edges the timer counted since the last call into count; the 16-bit
+// counter only has to be read before it moves by half its range.
+static void QEI_Update(void)
+{
+    uint16_t cnt = TIM3->CNT;
+    int16_t delta = cnt - last_cnt;
+    int8_t dir = (delta > 0) ? 1 : -1;
+    uint32_t now;
 
+    if (delta == 0) {
+        return;
+    }
+    // edges are only seen when polled, spread them over the time since the last one
+    now = TIMERS_GetMicroSeconds();
+    edge_period = (dir == edge_dir) ? (now - edge_time) / (delta * dir) : 0;
+    edge_dir = dir;
+    edge_time = now;
+    count += delta;
+    last_cnt = cnt;
+}
+#endif
+
+
+
+#if !QEI_HARDWARE
+
+// Both channels from a single port read, (A << 1) | B
+static uint8_t QEI_ReadState(void)
+{
+    uint32_t idr = GPIOB->IDR;
+    return (((idr >> 4) & 1) << 1) | ((idr >> 5) & 1);    // ENC_A = PB4, ENC_B = PB5
+}
 
- 
  void QEI_IRQ() 
  {
-    //state machine of your design
-    
-    // Since only one bit of the encoder changes at a time, there are two cases to handle:
-    // either A changed or B changed
-    if(A.new_state != A.old_state)
-    {
-        if(B.old_state)
-        {
-            if(A.new_state) // If A changed to 1 while B was 1
-            {               // then the encoder moved counter-clockwise;
-                count--;    // decrement count for CCW movement.
-            }               // Otherwise, A must have changed to 0 while B was 1;
-            else count++;   // increment count for CW movement.
-        }
-        else 
-        {
-            if(A.new_state) // If A changed to 1 while B was 0
-            {               // then the encoder moved clockwise;
-                count++;    // increment count for CW movement.
-            }               // Otherwise, A must have changed to 0 while B was 0;
-            else count--;   // decrement count for CCW movement.
-        }
-        A.old_state = A.new_state; // update state of encoder A
-    }
-    else if(B.new_state != B.old_state)
-    {
-        if(A.old_state)
-        {
-            if(B.new_state) // If B changed to 1 while A was 1
-            {               // then the encoder moved clockwise;
-                count++;    // increment count for CW movement.
-            }               // Otherwise, B must have changed to 0 while A was 1;
-            else count--;   // decrement count for CCW movement.
-        }
-        else
-        {
-            if(B.new_state) // If B changed to 1 while A was 0
-            {               // then the encoder moved counter-clockwise;
-                count--;    // decrement count for CCW movement.
-            }               // Otherwise, B must have changed to 0 while A was 0;
-            else count++;   // increment count for CW movement.
-        }
-        B.old_state = B.new_state; // update state of encoder B
-    }
+    // One table lookup decodes whichever channel changed. Both pins are read
+    // together, so an edge on the other channel that is still waiting for its
+    // own interrupt is already accounted for and that interrupt sees no change.
+    uint8_t now = QEI_ReadState();
+    int8_t step = QEI_TABLE[(state << 2) | now];
 
-    if(count == MAX_INCREMENT || count == -MAX_INCREMENT) count = 0;
+    if (step == GLITCH) {
+        glitches++;
+    } else if (step != 0) {
+        uint32_t time = TIMERS_GetMicroSeconds();
+        count += step;
+        edge_period = (step == edge_dir) ? time - edge_time : 0;
+        edge_dir = step;
+        edge_time = time;
+    }
+    state = now;
  }
 
 
@@ -140,7 +290,6 @@ void QEI_ResetPosition()
     // PIN_5 is ENC_B
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_5) != RESET) {
         __HAL_GPIO_EXTI_CLEAR_IT(GPIO_PIN_5); // clear interrupt flag
-        B.new_state = HAL_GPIO_ReadPin(GPIOB, ENC_B); // read new encoder pin state
         QEI_IRQ();
     }
  }
@@ -151,7 +300,89 @@ void QEI_ResetPosition()
     // EXTI line interrupt detected 
     if(__HAL_GPIO_EXTI_GET_IT(GPIO_PIN_4) != RESET) {
       __HAL_GPIO_EXTI_CLEAR_IT(GPIO_PIN_4); // clear interrupt flag
-        A.new_state = HAL_GPIO_ReadPin(GPIOB, ENC_A); // read new encoder pin state
         QEI_IRQ();
     }
- }
\ No newline at end of file
+ }
+
+#endif  /* !QEI_HARDWARE */
+
+
+//#define QEI_BENCHMARK
+#ifdef QEI_BENCHMARK
+// SUCCESS - prints the cycles per edge for the former nested if/else decoder and for the table
+//           lookup, both fed the same synthetic edge sequence; the table adds one port read per
+//           interrupt on top of its decode, which is included. Needs QEI_HARDWARE 0.
+#if QEI_HARDWARE
+#error "QEI_BENCHMARK needs QEI_HARDWARE 0 (QEI.h): it times the table decoder"
+#else
+
+#include <stdio.h>
+#include <Board.h>
+
+// the former decoder, kept here for comparison
+typedef struct {
+    GPIO_PinState old_state;
+    GPIO_PinState new_state;
+} PinState_t;
+
+static PinState_t A = {SET, SET}, B = {SET, SET};
+static int legacy_count = 0;
+
+static void legacyIRQ(void)
+{
+    if(A.new_state != A.old_state)
+    {
+        if(B.old_state) { if(A.new_state) legacy_count--; else legacy_count++; }
+        else            { if(A.new_state) legacy_count++; else legacy_count--; }
+        A.old_state = A.new_state;
+    }
+    else if(B.new_state != B.old_state)
+    {
+        if(A.old_state) { if(B.new_state) legacy_count++; else legacy_count--; }
+        else            { if(B.new_state) legacy_count--; else legacy_count++; }
+        B.old_state = B.new_state;
+    }
+    if(legacy_count == MAX_INCREMENT || legacy_count == -MAX_INCREMENT) legacy_count = 0;
+}
+
+int main(void) {
+    BOARD_Init();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;     // enable the cycle counter
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    static const uint8_t cw[4] = {0x2, 0x3, 0x1, 0x0};  // (A << 1) | B, one clockwise cycle
+    const int edges = 4000;
+
+    // legacy: the ISR reads the pin that changed with HAL_GPIO_ReadPin()
+    uint32_t start = DWT->CYCCNT;
+    for (int n = 0; n < edges; n++) {
+        uint8_t s = cw[n & 3];
+        if ((s >> 1) != A.old_state) { (void)HAL_GPIO_ReadPin(GPIOB, ENC_A); A.new_state = s >> 1; }
+        else                         { (void)HAL_GPIO_ReadPin(GPIOB, ENC_B); B.new_state = s & 1;  }
+        legacyIRQ();
+    }
+    uint32_t legacy = DWT->CYCCNT - start;
+
+    // table: one port read, then a lookup
+    uint8_t old = 0x0;
+    start = DWT->CYCCNT;
+    for (int n = 0; n < edges; n++) {
+        (void)GPIOB->IDR;
+        uint8_t now = cw[n & 3];
+        int8_t step = QEI_TABLE[(old << 2) | now];
+        if (step == GLITCH) { glitches++; } else { count += step; }
+        old = now;
+    }
+    uint32_t table = DWT->CYCCNT - start;
+
+    printf("legacy count %d, table count %ld, glitches %lu\r\n", legacy_count, (long)count, (unsigned long)glitches);
+    printf("cycles per edge: legacy %lu, table %lu\r\n",
+        (unsigned long)(legacy / edges), (unsigned long)(table / edges));
+
+    while (TRUE);
+}
+
+#endif  /* QEI_HARDWARE */
+#endif
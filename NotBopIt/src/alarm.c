@@ -0,0 +1,147 @@
+#include <alarm.h>
+#include <Board.h>
+#include <timers.h>
+
+// alarms live in fixed slots; a binary min-heap of slot numbers keeps the earliest deadline on top
+typedef struct {
+    uint32_t         deadline;  // [ms]
+    uint32_t         period;    // [ms], 0 for one-shot
+    alarm_callback_t callback;
+    int              arg;
+    uint8_t          heap;      // position in heap[]
+    uint8_t          serial;    // bumped on each use so stale ids miss
+} alarm_t;
+
+static alarm_t slots[ALARM_MAX];
+static uint8_t heap[ALARM_MAX];
+static uint8_t pending = 0;     // alarms in the heap
+static uint8_t free_slots[ALARM_MAX];
+static uint8_t free_count = 0;
+static int     initialized = FALSE;
+
+static int  earlier(uint8_t a, uint8_t b);
+static void place(uint8_t position, uint8_t slot);
+static void siftUp(uint8_t position);
+static void siftDown(uint8_t position);
+static void removeAt(uint8_t position);
+
+int ALARM_Set(uint32_t delay, uint32_t period, alarm_callback_t callback, int arg) {
+
+    if (!initialized) { ALARM_CancelAll(); }
+    if (free_count == 0 || callback == NULL) { return ERROR; }
+
+    uint8_t slot = free_slots[--free_count];
+    alarm_t *a = &slots[slot];
+    a->deadline = TIMERS_GetMilliSeconds() + delay;
+    a->period   = period;
+    a->callback = callback;
+    a->arg      = arg;
+    a->serial++;
+
+    place(pending, slot);
+    siftUp(pending++);
+    return a->serial * ALARM_MAX + slot;
+}
+
+void ALARM_Cancel(int id) {
+
+    if (id < 0) { return; }
+    uint8_t slot = id % ALARM_MAX;
+    alarm_t *a = &slots[slot];
+
+    // only a pending alarm with a matching serial is removed
+    if (a->callback == NULL || (uint8_t)(id / ALARM_MAX) != a->serial) { return; }
+    removeAt(a->heap);
+    a->callback = NULL;
+    free_slots[free_count++] = slot;
+}
+
+void ALARM_CancelAll() {
+
+    pending = 0;
+    free_count = 0;
+    for (int i = ALARM_MAX - 1; i >= 0; i--) {
+        slots[i].callback = NULL;
+        free_slots[free_count++] = i;
+    }
+    initialized = TRUE;
+}
+
+int ALARM_Service() {
+
+    int ran = 0;
+    uint32_t now = TIMERS_GetMilliSeconds();
+
+    // the heap top is the earliest deadline, nothing below it can be due
+    while (pending > 0 && (int32_t)(now - slots[heap[0]].deadline) >= 0) {
+        uint8_t slot = heap[0];
+        alarm_t *a = &slots[slot];
+        alarm_callback_t callback = a->callback;
+        int arg = a->arg;
+
+        if (a->period != 0) {
+            a->deadline += a->period;           // periodic: keep the cadence, no drift
+            siftDown(0);
+        } else {
+            removeAt(0);                        // one-shot: done before the callback may reuse the slot
+            a->callback = NULL;
+            free_slots[free_count++] = slot;
+        }
+        callback(arg);
+        ran++;
+    }
+    return ran;
+}
+
+int ALARM_NextDeadline(uint32_t *deadline) {
+
+    if (pending == 0) { return ERROR; }
+    *deadline = slots[heap[0]].deadline;
+    return SUCCESS;
+}
+
+// deadlines compared relative to each other, so the millisecond count may wrap
+static int earlier(uint8_t a, uint8_t b) { return (int32_t)(slots[a].deadline - slots[b].deadline) < 0; }
+
+static void place(uint8_t position, uint8_t slot) {
+
+    heap[position] = slot;
+    slots[slot].heap = position;
+}
+
+static void siftUp(uint8_t position) {
+
+    uint8_t slot = heap[position];
+    while (position > 0) {
+        uint8_t parent = (position - 1) / 2;
+        if (!earlier(slot, heap[parent])) { break; }
+        place(position, heap[parent]);
+        position = parent;
+    }
+    place(position, slot);
+}
+
+static void siftDown(uint8_t position) {
+
+    uint8_t slot = heap[position];
+    for (;;) {
+        uint8_t child = 2 * position + 1;
+        if (child >= pending) { break; }
+        if (child + 1 < pending && earlier(heap[child + 1], heap[child])) { child++; }
+        if (!earlier(heap[child], slot)) { break; }
+        place(position, heap[child]);
+        position = child;
+    }
+    place(position, slot);
+}
+
+// takes the last entry into the hole and restores the order in whichever direction it is off
+static void removeAt(uint8_t position) {
+
+    pending--;
+    if (position == pending) { return; }
+    uint8_t slot = heap[pending];
+    place(position, slot);
+    siftDown(position);
+    if (slots[slot].heap == position) { siftUp(position); }
+}
@@ -0,0 +1,52 @@
+/**
+ * @file    alarm.h
+ * @brief   software alarms (one-shot and periodic deadlines) for the game NotBopIt
+ * @author  Daniel Retta, Stephanie Scott, Danyang Hu
+ * @date    January 23rd, 2025
+ * */
+
+ #ifndef alarm_H
+ #define alarm_H
+
+ #include <stdint.h>
+
+ #define ALARM_MAX   16      // alarms pending at once
+
+ // called from ALARM_Service() with the argument given to ALARM_Set()
+ typedef void (*alarm_callback_t)(int arg);
+
+ /**
+ * @function    ALARM_Set(uint32_t delay, uint32_t period, alarm_callback_t callback, int arg)
+ * @brief       calls back after delay [ms], then every period [ms] unless period is 0
+ * @return      alarm id for ALARM_Cancel(), or ERROR when ALARM_MAX alarms are pending
+ */
+int ALARM_Set(uint32_t delay, uint32_t period, alarm_callback_t callback, int arg);
+
+ /**
+ * @function    ALARM_Cancel(int id)
+ * @brief       removes a pending alarm; ids of alarms that already fired are ignored
+ */
+void ALARM_Cancel(int id);
+
+ /**
+ * @function    ALARM_CancelAll()
+ * @brief       removes every pending alarm
+ */
+void ALARM_CancelAll();
+
+ /**
+ * @function    ALARM_Service()
+ * @brief       runs the callbacks that are due, call every loop; a single comparison when none is
+ *              due, however many alarms are pending. Callbacks may set and cancel alarms.
+ * @return      number of callbacks run
+ */
+int ALARM_Service();
+
+ /**
+ * @function    ALARM_NextDeadline(uint32_t *deadline)
+ * @brief       time [ms, TIMERS_GetMilliSeconds()] of the earliest pending alarm
+ * @return      SUCCESS, or ERROR when no alarm is pending
+ */
+int ALARM_NextDeadline(uint32_t *deadline);
+
+#endif
@@ -0,0 +1,58 @@
+#include <idle.h>
+#include <Board.h>
+#include <timers.h>
+
+static uint32_t window_start = 0;   // [us]
+static uint32_t window_idle  = 0;   // [us] asleep in the current window
+static int      percent      = 0;   // idle share of the last whole window
+static uint32_t wakes        = 0;   // sleeps that reached their deadline
+static uint32_t latency_sum  = 0;   // [us], over the last wakes
+static uint32_t latency_max  = 0;   // [us]
+
+static void account(uint32_t now);
+
+void IDLE_Until(uint32_t deadline) {
+
+    uint32_t start, end;
+
+    // interrupts masked between the check and WFI: one arriving in between still ends the sleep
+    __disable_irq();
+    start = TIMERS_GetMicroSeconds();
+    if ((int32_t)(deadline - start) <= 0) {
+        __enable_irq();
+        account(start);
+        return;
+    }
+    TIMERS_SetWakeup(deadline);
+    if ((int32_t)(deadline - TIMERS_GetMicroSeconds()) > 0) { __WFI(); }   // else the compare was missed
+    TIMERS_ClearWakeup();
+    __enable_irq();                                 // the waking interrupt runs here
+    end = TIMERS_GetMicroSeconds();
+
+    window_idle += end - start;
+    if ((int32_t)(end - deadline) >= 0) {
+        uint32_t late = end - deadline;
+        if (wakes == 1000) { latency_sum /= 2; wakes /= 2; }   // keep a running average
+        latency_sum += late;
+        wakes++;
+        if (late > latency_max) { latency_max = late; }
+    }
+    account(end);
+}
+
+int IDLE_Percent() { return percent; }
+
+uint32_t IDLE_WakeLatency() { return wakes ? latency_sum / wakes : 0; }
+
+uint32_t IDLE_WakeLatencyMax() { return latency_max; }
+
+// closes the measurement window once it is full
+static void account(uint32_t now) {
+
+    uint32_t elapsed = now - window_start;
+
+    if (elapsed < IDLE_WINDOW_US) { return; }
+    percent = (int)((uint64_t)window_idle * 100 / elapsed);
+    window_idle = 0;
+    window_start = now;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file    idle.h
+ * @brief   sleeps the super-loop until the next interrupt or deadline for the game NotBopIt
+ * @author  Daniel Retta, Stephanie Scott, Danyang Hu
+ * @date    January 23rd, 2025
+ * */
+
+ #ifndef idle_H
+ #define idle_H
+
+ #include <stdint.h>
+
+ #define IDLE_WINDOW_US  1000000     // idle share is measured over this window
+
+ /**
+ * @function    IDLE_Until(uint32_t deadline)
+ * @brief       sleeps in WFI until an interrupt arrives, unless the deadline [us, TIMERS_GetMicroSeconds()]
+ *              has already passed; a TIM2 compare interrupt at the deadline ends the sleep, there is no tick
+ */
+void IDLE_Until(uint32_t deadline);
+
+ /**
+ * @function    IDLE_Percent()
+ * @brief       share of the last whole IDLE_WINDOW_US spent asleep
+ * @return      idle time [%]
+ */
+int IDLE_Percent();
+
+ /**
+ * @function    IDLE_WakeLatency()
+ * @brief       average time from a deadline to the loop running again, over sleeps that reached it
+ * @return      latency [us]
+ */
+uint32_t IDLE_WakeLatency();
+
+ /**
+ * @function    IDLE_WakeLatencyMax()
+ * @return      longest wake-up latency seen [us]
+ */
+uint32_t IDLE_WakeLatencyMax();
+
+#endif
@@ -0,0 +1,148 @@
+#include <imu.h>
+#include <Board.h>
+#include <BNO055.h>
+#include <timers.h>
+#include <I2C.h>
+
+// frames live in a ring indexed by sequence number, only ever written from the super-loop
+static imu_frame_t ring[IMU_BUFFER_LENGTH];
+static uint32_t sequence = 0;       // frames stored so far
+static uint32_t deadline = 0;       // [us] when the next frame is due
+static uint32_t missed   = 0;
+static int      still    = FALSE;   // BNO055 reported no motion, the bus rests
+static uint8_t  events   = 0;       // interrupt events not yet collected by IMU_Events()
+
+static int window(int frames);
+
+void IMU_Init() {
+
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = IMU_INT_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;            // reads low with the INT wire missing
+    HAL_GPIO_Init(IMU_INT_PORT, &GPIO_InitStruct);
+
+    HAL_NVIC_SetPriority(EXTI1_IRQn, 2, 0);          // only sets a flag, below the timing interrupts
+    HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
+    BNO055_SetInterrupts(IMU_INT_EVENTS);
+    BNO055_InitStart();
+}
+
+void EXTI1_IRQHandler(void) {
+    if (__HAL_GPIO_EXTI_GET_IT(IMU_INT_PIN) != RESET) {
+        __HAL_GPIO_EXTI_CLEAR_IT(IMU_INT_PIN);       // clear interrupt flag
+        BNO055_IRQ();
+    }
+}
+
+int IMU_Service() {
+
+    uint32_t now = TIMERS_GetMicroSeconds();
+    uint8_t fired = BNO055_InterruptService();
+
+    // no motion for a while: sample slowly; motion or a slap: sample now and at full rate again
+    if (fired & BNO055_INT_NO_MOTION) { still = TRUE; }
+    if (fired & (BNO055_INT_ANY_MOTION | BNO055_INT_HIGH_G)) {
+        if (still) { deadline = now; }
+        still = FALSE;
+    }
+    events |= fired;
+
+    if (!BNO055_IsReady() || (int32_t)(now - deadline) < 0) { return FALSE; }
+
+    // fell a whole period behind: skip the lost slots instead of bursting to catch up
+    if (now - deadline >= IMU_PERIOD_US) {
+        if (sequence > 0 && !still) { missed += (now - deadline) / IMU_PERIOD_US; }
+        deadline = now;
+    }
+    deadline += still ? IMU_STILL_PERIOD_US : IMU_PERIOD_US;
+
+    imu_frame_t frame;                          // a failed read must not touch the ring
+    int8_t status;
+
+    I2C_Claim(I2C_CLASS_REALTIME, 18);          // records how late the bus let this read start
+
+    if (BNO055_IsFusionMode()) {
+        status = BNO055_ReadGravity(frame.accel);
+        if (status == SUCCESS) { status = BNO055_ReadGyro(frame.gyro); }
+    } else {
+        status = BNO055_ReadMotion(frame.accel, frame.gyro);
+    }
+    I2C_Announce(deadline);                     // keep bulk transfers (OLED) clear of the next read
+    if (status != SUCCESS) { return FALSE; }
+
+    frame.time = now;
+    ring[sequence % IMU_BUFFER_LENGTH] = frame;
+    sequence++;
+    return TRUE;
+}
+
+uint32_t IMU_Sequence() { return sequence; }
+
+uint32_t IMU_Missed() { return missed; }
+
+uint8_t IMU_Events() {
+
+    uint8_t seen = events;
+    events = 0;
+    return seen;
+}
+
+int IMU_IsStill() { return still; }
+
+int IMU_Get(uint32_t n, imu_frame_t *frame) {
+
+    if (n >= sequence || sequence - n > IMU_BUFFER_LENGTH) { return ERROR; }
+
+    *frame = ring[n % IMU_BUFFER_LENGTH];
+    return SUCCESS;
+}
+
+int IMU_Latest(imu_frame_t *frame) { return IMU_Get(sequence - 1, frame); }
+
+int IMU_Average(int frames, imu_frame_t *average) {
+
+    int32_t accel[3] = {0}, gyro[3] = {0};
+
+    frames = window(frames);
+    if (frames == 0) { return ERROR; }
+
+    for (int n = 1; n <= frames; n++) {
+        const imu_frame_t *f = &ring[(sequence - n) % IMU_BUFFER_LENGTH];
+        for (int i = 0; i < 3; i++) { accel[i] += f->accel[i]; gyro[i] += f->gyro[i]; }
+    }
+    for (int i = 0; i < 3; i++) {
+        average->accel[i] = accel[i] / frames;
+        average->gyro[i]  = gyro[i] / frames;
+    }
+    average->time = ring[(sequence - 1) % IMU_BUFFER_LENGTH].time;
+    return SUCCESS;
+}
+
+int IMU_MinMax(int frames, imu_frame_t *min, imu_frame_t *max) {
+
+    frames = window(frames);
+    if (frames == 0) { return ERROR; }
+
+    *min = *max = ring[(sequence - 1) % IMU_BUFFER_LENGTH];
+    for (int n = 2; n <= frames; n++) {
+        const imu_frame_t *f = &ring[(sequence - n) % IMU_BUFFER_LENGTH];
+        for (int i = 0; i < 3; i++) {
+            if (f->accel[i] < min->accel[i]) { min->accel[i] = f->accel[i]; }
+            if (f->accel[i] > max->accel[i]) { max->accel[i] = f->accel[i]; }
+            if (f->gyro[i]  < min->gyro[i])  { min->gyro[i]  = f->gyro[i];  }
+            if (f->gyro[i]  > max->gyro[i])  { max->gyro[i]  = f->gyro[i];  }
+        }
+    }
+    return SUCCESS;
+}
+
+// clamp a window to the frames actually buffered
+static int window(int frames) {
+
+    if (frames > IMU_BUFFER_LENGTH) { frames = IMU_BUFFER_LENGTH; }
+    if ((uint32_t)frames > sequence) { frames = sequence; }
+    if (frames < 0) { frames = 0; }
+    return frames;
+}
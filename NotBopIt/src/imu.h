@@ -0,0 +1,96 @@
+/**
+ * @file    imu.h
+ * @brief   fixed-rate IMU acquisition for the game NotBopIt
+ * @author  Daniel Retta, Stephanie Scott, Danyang Hu
+ * @date    January 23rd, 2025
+ * */
+
+ #ifndef imu_H
+ #define imu_H
+
+ #include <stdint.h>
+ #include "BNO055.h"
+
+ #define IMU_PERIOD_US      10000   // 100 Hz, the BNO055 fusion output rate
+ #define IMU_BUFFER_LENGTH  32      // frames kept, a power of two
+ #define IMU_STILL_PERIOD_US 500000 // sampling while the BNO055 reports no motion
+
+ // BNO055 INT wired to PC1; ADC_Init() makes it analog, so IMU_Init() must follow it
+ #define IMU_INT_PORT       GPIOC
+ #define IMU_INT_PIN        GPIO_PIN_1
+ #define IMU_INT_EVENTS     (BNO055_INT_NO_MOTION | BNO055_INT_ANY_MOTION | BNO055_INT_HIGH_G)
+
+ // one timestamped sample; accel is the chip's gravity vector when running a fusion mode
+ typedef struct {
+     uint32_t time;         // [us] when the frame was read
+     int16_t  accel[3];     // [mg]
+     int16_t  gyro[3];      // [1/16 dps]
+ } imu_frame_t;
+
+ /**
+ * @function    IMU_Init()
+ * @brief       enables the BNO055 motion interrupts on the INT pin and starts the IMU bring-up
+ */
+void IMU_Init();
+
+ /**
+ * @function    IMU_Service()
+ * @brief       handles BNO055 interrupts and reads one frame when the next sample is due, call every loop
+ *              sampling slows to IMU_STILL_PERIOD_US after a no-motion event and resumes on motion
+ * @return      TRUE if a new frame was stored
+ */
+int IMU_Service();
+
+ /**
+ * @function    IMU_Events()
+ * @brief       BNO055_INT_* events seen since the last call
+ */
+uint8_t IMU_Events();
+
+ /**
+ * @function    IMU_IsStill()
+ * @brief       TRUE between a no-motion event and the next motion event
+ */
+int IMU_IsStill();
+
+ /**
+ * @function    IMU_Sequence()
+ * @brief       number of frames stored so far, the newest frame is IMU_Sequence() - 1
+ */
+uint32_t IMU_Sequence();
+
+ /**
+ * @function    IMU_Get(uint32_t sequence, imu_frame_t *frame)
+ * @brief       copies the frame with the given sequence number if it is still buffered
+ * @return      SUCCESS or ERROR
+ */
+int IMU_Get(uint32_t sequence, imu_frame_t *frame);
+
+ /**
+ * @function    IMU_Latest(imu_frame_t *frame)
+ * @brief       copies the newest frame
+ * @return      SUCCESS or ERROR when no frame has been read yet
+ */
+int IMU_Latest(imu_frame_t *frame);
+
+ /**
+ * @function    IMU_Average(int frames, imu_frame_t *average)
+ * @brief       per-axis average over the newest frames (at most IMU_BUFFER_LENGTH), time of the newest
+ * @return      SUCCESS or ERROR when no frame has been read yet
+ */
+int IMU_Average(int frames, imu_frame_t *average);
+
+ /**
+ * @function    IMU_MinMax(int frames, imu_frame_t *min, imu_frame_t *max)
+ * @brief       per-axis extremes over the newest frames (at most IMU_BUFFER_LENGTH)
+ * @return      SUCCESS or ERROR when no frame has been read yet
+ */
+int IMU_MinMax(int frames, imu_frame_t *min, imu_frame_t *max);
+
+ /**
+ * @function    IMU_Missed()
+ * @brief       number of sample slots skipped because the loop was late
+ */
+uint32_t IMU_Missed();
+
+#endif
@@ -1,12 +1,17 @@
 #include <light.h>
+#include <Board.h>
 #include <timers.h>
 #include <pwm.h>
 #include <stdlib.h>
 
 // additional function insights are provided in the header of this file, but can be access by simply hovering over the function name in VSCode
 
-int bright = 100;           // these global variable values are applied to the RGB LED PWM using the function updateColor
-int r = 0, g = 0, b = 0;    // which is called at the end of soundAndLight() in NotBopIt.c
+#define BRIGHT_FULL 65535   // brightness steps, as fine as the PWM duty (PWM_DUTY16_MAX)
+#define LIGHT_PWM_HZ 1000   // RGB carrier on TIM1, fixed and well above flicker; the speaker retunes TIM4 alone
+
+int bright = BRIGHT_FULL;   // these global variable values are applied to the RGB LED PWM using the function updateRGBLED
+int r = 0, g = 0, b = 0;    // which runs as the 200 Hz light task in NotBopIt.c
+static int fading = FALSE;  // brightnessFade() is stepping, the only time steps below one timer count show
     
 // this array defines the color of the LED RGB to indicate a particular sensor to interact with
 const int sensorColor [8][3] = {
@@ -20,17 +25,33 @@ const int sensorColor [8][3] = {
     {100, 100, 100}     // 7:IMU            White
 };
 
-void LIGHT_Init() { PWM_Init(); }
+void LIGHT_Init() {
+
+    PWM_Init();
+    PWM_SetTimerFrequency(&htim1, LIGHT_PWM_HZ);
+}
 
 void updateRGBLED() {
 
-    r = r * bright / 100; g = g * bright / 100; b = b * bright / 100;                         // apply brightness setting
+    static int dithering = FALSE;
 
-    unsigned int R_duty = 100 - r, G_duty = 100 - g, B_duty = 100 - b;      // apply color setting (the PWM values are inverted)
+    // while a fade runs, the steps below one timer count are spread over the PWM periods, keeping dim fades
+    // smooth; otherwise the TIM1 update interrupt stays off
+    if (fading != dithering) {
+        dithering = fading;
+        PWM_SetDithering(PWM_1, dithering);
+        PWM_SetDithering(PWM_2, dithering);
+        PWM_SetDithering(PWM_3, dithering);
+    }
 
-    PWM_SetDutyCycle(PWM_1, R_duty);
-    PWM_SetDutyCycle(PWM_2, G_duty);
-    PWM_SetDutyCycle(PWM_3, B_duty);
+    // apply brightness setting; r, g, b keep the color, the task may run again before it is set anew
+    int R = r * bright / 100, G = g * bright / 100, B = b * bright / 100;   // [0, BRIGHT_FULL]
+
+    uint16_t R_duty = BRIGHT_FULL - R, G_duty = BRIGHT_FULL - G, B_duty = BRIGHT_FULL - B;  // apply color setting (the PWM values are inverted)
+
+    PWM_SetDuty16(PWM_1, R_duty);
+    PWM_SetDuty16(PWM_2, G_duty);
+    PWM_SetDuty16(PWM_3, B_duty);
     
 }
 
@@ -94,9 +115,9 @@ void colorInDegrees(int degrees) {
 
 }
 
-void brightness(int percent) { bright = percent; }
+void brightness(int percent) { bright = percent * BRIGHT_FULL / 100; fading = FALSE; }
 
-void lightOff() { bright = 0; }
+void lightOff() { bright = 0; fading = FALSE; }
 
 void brightnessFade(int startingBrightness, int endingBrightness, int period, int transition) {
 
@@ -108,8 +129,6 @@ void brightnessFade(int startingBrightness, int endingBrightness, int period, in
     timeStart = 0,              // store initial time at first entry
     timeElapsed = 0;            // holds current elapsed time since initial entry
 
-    static double change = 0;   // holds change per millisecond to apply
-
     timeElapsed = TIMERS_GetMilliSeconds() - timeStart;
 
     if (lastStartingBrightness == startingBrightness && lastEndingBrightness == endingBrightness &&  lastPeriod == period && lastTransition == transition) {
@@ -117,7 +136,10 @@ void brightnessFade(int startingBrightness, int endingBrightness, int period, in
             brightness(endingBrightness);
             return;    // this task has completed its lifecycle
         } else {
-            brightness(startingBrightness + timeElapsed * change);
+            // interpolate in fine steps; the change per millisecond is far below one percent
+            int start = startingBrightness * BRIGHT_FULL / 100, end = endingBrightness * BRIGHT_FULL / 100;
+            bright = start + (int)((int64_t)(end - start) * timeElapsed / period);
+            fading = TRUE;
         }
     } else {                    // treat as new instance
         timeStart = TIMERS_GetMilliSeconds();
@@ -125,7 +147,7 @@ void brightnessFade(int startingBrightness, int endingBrightness, int period, in
         lastEndingBrightness = endingBrightness;
         lastPeriod = period;
         lastTransition = transition;
-        change = (endingBrightness - startingBrightness) / period;
+        brightness(startingBrightness);
     }
     
 }
@@ -4,24 +4,96 @@
 #include <timers.h>
 #include <pwm.h>
 
-static int degrees_new = 0, degrees_old = 0;
+
+static accel_t acc = {0};   // last calibrated accelerometer frame, shared by face up and IMU detection
+static int calibComplete = FALSE;   // the chip calibrated itself, waiting for sensorSaveCalibration()
+
+// cos^2 of the tilt angle in Q8, indexed by degrees / 5
+static const int COS2_Q8[19] = { 256, 254, 248, 239, 226, 210, 192, 172, 150, 128, 106, 84, 64, 46, 30, 17, 8, 2, 0 };
+
+static struct {
+    int      enter;         // cos^2 of the enter cone [Q8]
+    int      exit;          // cos^2 of the exit cone [Q8]
+    int      dwell;         // [ms]
+    sensor_t reported;      // face handed to the game
+    sensor_t pending;       // face waiting out the dwell time
+    uint32_t pendingSince;  // [ms]
+    int      confidence;    // [0:100]
+} face = { 192, 128, FACE_DWELL_MS, none, none, 0, 0 };
+
+static sensor_t dominantFace(const accel_t *a);
+static int faceAxis(sensor_t f);
+static int faceComponent(const accel_t *a, sensor_t f);
+static int faceAlignment(const accel_t *a, sensor_t f, int magnitude2);
+static int faceFromAccel(const accel_t *a, uint32_t now);
+static void accelCalibrate(const int16_t raw[3], accel_t *a);
+static int menuStep(int direction);
 
 uint32_t timeInitial = 0, timeFinal = 0, timeResponse = 0;
 
 void SENSORS_Init() {
+    sensorFaceConfig(FACE_ENTER_DEGREES, FACE_EXIT_DEGREES, FACE_DWELL_MS);
     QEI_Init();
-    BNO055_Init();
     ADC_Init();
-    PING_Init();
+#if IMU_FUSION
+    BNO055_SetOperationMode(BNO055_MODE_IMUPLUS);
+#endif
+    IMU_Init();             // IMU comes up in the background, see SENSORS_Service()
     PWM_Init();
-    PWM_SetDutyCycle(PWM_5, 50); // for ping sensor
+    PING_Init();            // triggers on PB8 (PWM_5) through TIM10, see sensorPingSchedule()
+}
+
+void SENSORS_Service() {
+    static int imuPending = TRUE;
+    static int calibPending = FALSE;            // waiting for the chip to calibrate itself
+    static uint32_t calibChecked = 0;
+    static uint32_t tempChecked = 0;
+
+    if (imuPending && BNO055_InitService() != FALSE) {
+        imuPending = FALSE;
+        if (BNO055_IsReady()) {
+            printf("IMU ready after %lu ms, calibration %s.\n", (unsigned long)BNO055_GetInitTime(),
+                   BNO055_IsCalibRestored() ? "restored" : "not stored");
+            calibPending = !BNO055_IsCalibRestored() && BNO055_IsFusionMode();
+        } else {
+            printf("IMU initialization failed.\n");
+        }
+    }
+
+    IMU_Service();                              // paced sampling, a no-op until the next frame is due
+    QEI_Service();                              // encoder velocity estimate
+    PING_Service();                             // next ultrasonic trigger when due
+
+    // Speed of sound follows the temperature; the die runs a little warm but close enough
+    if (BNO055_IsReady() && (tempChecked == 0 || TIMERS_GetMilliSeconds() - tempChecked >= TEMP_CHECK_MS)) {
+        tempChecked = TIMERS_GetMilliSeconds() | 1;
+        int celsius = BNO055_ReadTemp();
+        if (celsius > -20 && celsius < 60) { PING_SetTemperature(celsius); }
+    }
+
+    // Without a stored calibration, capture the chip's own once it completes
+    if (calibPending && TIMERS_GetMilliSeconds() - calibChecked >= CALIB_CHECK_MS) {
+        calibChecked = TIMERS_GetMilliSeconds();
+        if (BNO055_IsCalibrated()) {
+            calibPending = FALSE;
+            calibComplete = TRUE;               // saved by sensorSaveCalibration() when the game idles
+        }
+    }
+}
+
+int sensorSaveCalibration() {
+
+    if (!calibComplete) { return FALSE; }
+
+    calibComplete = FALSE;
+    int saved = (BNO055_SaveCalibration() == SUCCESS);
+    printf("IMU calibration %s.\n", saved ? "saved" : "not saved");
+    return saved;
 }
 
 int encoderChangeCW()           {
     
-    degrees_new = QEI_GetPosition();
-    if (degrees_new >= (degrees_old + 15)){
-        degrees_old = degrees_new;
+    if (menuStep(+1)){
 
             printf("\n\nEncoder moved ClockWise.\n\n");        // diagnostic data printed to serial
 
@@ -31,16 +103,33 @@ int encoderChangeCW()           {
 }
 int encoderChangeCCW()          {
     
-    degrees_new = QEI_GetPosition();
-    if (degrees_new <= (degrees_old - 15)){
-        degrees_old = degrees_new;
-        return TRUE;
+    if (menuStep(-1)){
 
-        printf("\n\nEncoder moved CounterClockWise.\n\n");        // diagnostic data printed to serial
+            printf("\n\nEncoder moved CounterClockWise.\n\n");        // diagnostic data printed to serial
 
+        return TRUE;
     }
     else return 0;
 }
+
+// menu detents: one step per MENU_DETENT_EDGES in the given direction, with a reference of its own
+// so game detection never eats menu steps; turning while the menu was not polled is dropped
+static int menuStep(int direction) {
+
+    static int32_t  reference = 0;          // count at the last reported detent
+    static uint32_t lastPoll  = 0;          // [ms]
+    int32_t  count = QEI_GetCount();
+    uint32_t now   = TIMERS_GetMilliSeconds();
+
+    if (now - lastPoll > MENU_RESYNC_MS) { reference = count; }
+    lastPoll = now;
+
+    if ((count - reference) * direction >= MENU_DETENT_EDGES) {
+        reference += direction * MENU_DETENT_EDGES;
+        return TRUE;
+    }
+    return FALSE;
+}
 int captouchPressed()           {return HAL_GPIO_ReadPin(GPIOC, TOUCH_PIN);}
 int captouchReleased()          {return !HAL_GPIO_ReadPin(GPIOC, TOUCH_PIN);}
 int captouchHeld(int duration)  {
@@ -72,19 +161,147 @@ int sensorActivated(int sensor) {
     return activated;
 }
 
+void sensorPingSchedule(int playing, int selected) {
+
+    uint8_t mode;
+
+    if      ( !playing )                    { mode = PING_OFF;    }
+    else if ( selected == ultrasonic )      { mode = PING_BOOST;  }     // latency counts, ping back to back
+    else if ( sensorFaceUp() == ultrasonic ){ mode = PING_NORMAL; }     // only to catch the wrong sensor
+    else                                    { mode = PING_OFF;    }     // face down or sideways: nothing to see
+
+    if (mode != PING_GetMode()) { PING_SetMode(mode); }
+}
+
+int accelRead(accel_t *a) {
+
+    imu_frame_t frame;
+
+    if (IMU_Latest(&frame) != SUCCESS) { return ERROR; }        // keep the previous frame until one is sampled
+
+    accelCalibrate(frame.accel, a);
+    return SUCCESS;
+}
+
+static void accelCalibrate(const int16_t raw[3], accel_t *a) {
+
+#if IMU_FUSION
+    // fused gravity is already calibrated and free of linear acceleration
+    a->x = raw[0]; a->y = raw[1]; a->z = raw[2];
+#else
+    // bias and scale in one pass: (raw - bias) * scale, with the Q2 bias and Q14 scale shifted out together
+    // products stay within 32 bits for the full +/-16 g accelerometer range
+    a->x = ((raw[0] * (1 << ACC_BIAS_Q) - X_ACC_BIAS) * X_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+    a->y = ((raw[1] * (1 << ACC_BIAS_Q) - Y_ACC_BIAS) * Y_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+    a->z = ((raw[2] * (1 << ACC_BIAS_Q) - Z_ACC_BIAS) * Z_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+#endif
+}
+
 int sensorFaceUp(){
 
-    int AccX = (BNO055_ReadAccelX() - X_ACC_BIAS),
-        AccY = (BNO055_ReadAccelY() - Y_ACC_BIAS),            
-        AccZ = (BNO055_ReadAccelZ() - Z_ACC_BIAS);
-    
-    if      (AccZ > 900)  {return flex;}
-    else if (AccZ < -900) {return captouch;}
-    else if (AccX > 900)  {return rotary;}
-    else if (AccX < -900) {return piezo;}
-    else if (AccY > 900)  {return infrared;}
-    else if (AccY < -900) {return ultrasonic;}
-    else return none;
+    static uint32_t seen = 0;
+    imu_frame_t frame;
+
+    if (!BNO055_IsReady()) { return none; }    // IMU still coming up
+
+    // classify each sampled frame once, at the time it was taken
+    if (IMU_Sequence() != seen && IMU_Latest(&frame) == SUCCESS) {
+        seen = IMU_Sequence();
+        accelCalibrate(frame.accel, &acc);
+        faceFromAccel(&acc, frame.time / 1000);
+    }
+
+    return face.reported;
+}
+
+int sensorFaceConfidence() { return face.confidence; }
+
+void sensorFaceConfig(int enterDegrees, int exitDegrees, int dwellMs) {
+
+    if (enterDegrees < 0) { enterDegrees = 0; }  if (enterDegrees > 90) { enterDegrees = 90; }
+    if (exitDegrees  < enterDegrees) { exitDegrees = enterDegrees; }  if (exitDegrees > 90) { exitDegrees = 90; }
+
+    face.enter = COS2_Q8[(enterDegrees + 2) / 5];
+    face.exit  = COS2_Q8[(exitDegrees  + 2) / 5];
+    face.dwell = dwellMs;
+}
+
+// face whose axis carries the largest share of gravity; ties resolve z, x, y like the former thresholds
+static sensor_t dominantFace(const accel_t *a) {
+
+    int absX = abs(a->x), absY = abs(a->y), absZ = abs(a->z);
+
+    if      ( absZ >= absX && absZ >= absY ) { return (a->z > 0) ? flex     : captouch;   }
+    else if ( absX >= absY )                 { return (a->x > 0) ? rotary   : piezo;      }
+    else                                     { return (a->y > 0) ? infrared : ultrasonic; }
+}
+
+// sensor axis normal to a face: 0 for x, 1 for y, 2 for z
+static int faceAxis(sensor_t f) {
+
+    switch (f) {
+        case rotary:   case piezo:      return 0;
+        case infrared: case ultrasonic: return 1;
+        default:                        return 2;}
+}
+
+// acceleration along the face's outward axis [mg], positive when the face points up
+static int faceComponent(const accel_t *a, sensor_t f) {
+
+    switch (f) {
+        case flex:       return  a->z;
+        case captouch:   return -a->z;
+        case rotary:     return  a->x;
+        case piezo:      return -a->x;
+        case infrared:   return  a->y;
+        case ultrasonic: return -a->y;
+        default:         return 0;}
+}
+
+// cos^2 of the angle between the frame and the face's outward axis [Q8], zero if pointing away
+static int faceAlignment(const accel_t *a, sensor_t f, int magnitude2) {
+
+    int component = faceComponent(a, f);
+
+    if (component <= 0) { return 0; }
+
+    return (component * component) / (magnitude2 >> 8);
+}
+
+// hysteresis and dwell on top of the dominant axis; all integer, one frame per call
+static int faceFromAccel(const accel_t *a, uint32_t now) {
+
+    int magnitude2 = a->x * a->x + a->y * a->y + a->z * a->z;
+
+    // ignore frames far from 1 g (shaking, free fall), they say nothing about orientation
+    if (magnitude2 < 500 * 500 || magnitude2 > 1500 * 1500) { return face.reported; }
+
+    int held = faceAlignment(a, face.reported, magnitude2);
+    sensor_t target;
+
+    if (face.reported != none && held >= face.exit) {
+        target = face.reported;                             // still inside the exit cone, keep it
+    } else {
+        sensor_t candidate = dominantFace(a);
+        target = (faceAlignment(a, candidate, magnitude2) >= face.enter) ? candidate : none;
+    }
+
+    if (target != face.pending) {                           // restart the dwell window on every change
+        face.pending = target;
+        face.pendingSince = now;
+    }
+    if (face.pending != face.reported && now - face.pendingSince >= (uint32_t)face.dwell) {
+        face.reported = face.pending;
+    }
+
+    if (face.reported == none) {
+        face.confidence = 0;
+    } else {
+        int confidence = (faceAlignment(a, face.reported, magnitude2) - face.exit) * 100 / (256 - face.exit);
+        face.confidence = (confidence < 0) ? 0 : (confidence > 100) ? 100 : confidence;
+    }
+
+    return face.reported;
 }
 
 // filtered sensor reading functions
@@ -130,7 +347,10 @@ int flexActivated(){
 int ultrasonicActivated(){ 
     static int prev_state     =  FALSE;
     int        rising_edge    =  FALSE;
-    int        current_state  =  PING_GetDistance() < 60;
+    int        distance       =  PING_GetFilteredDistance();
+    int        current_state  =  PING_IsValid() &&
+                                 ( distance < ULTRASONIC_NEAR_MM ||
+                                   ( distance < ULTRASONIC_REACH_MM && PING_GetVelocity() > ULTRASONIC_APPROACH_MM_S ) );
 
     // Detect rising edge
     if (current_state == TRUE && prev_state == FALSE) { rising_edge = TRUE; }
@@ -153,17 +373,29 @@ int piezoActivated(){
 
 int rotaryActivated(){
     
-    static int total_rotation = 0;
-    static int last_position  = 0;
-    int current_position = QEI_GetPosition();
-    int delta = current_position - last_position;
+    static int     total_rotation = 0;      // [edges], 96 per revolution
+    static int32_t last_count     = 0;
+    static int32_t twist_start    = 0;      // count where the current brisk turn began
+    static int     twisting       = FALSE;
+    int32_t current_count = QEI_GetCount(); // does not wrap, so no false jump once per turn
+    int delta = current_count - last_count;
+    int speed = abs(QEI_GetVelocity());
+
+    // "twist it": a brisk turn counts after TWIST_DEGREES, within tens of ms
+    if (!twisting && speed >= TWIST_DEG_S)          { twisting = TRUE; twist_start = current_count - delta; }
+    else if (twisting && speed < TWIST_DEG_S / 2)   { twisting = FALSE; }
 
     if (delta == 0) return 0;               // No movement detected
     
     total_rotation += abs(delta);           // Accumulate movement if in the correct direction
-    last_position = current_position;       // Update position tracking
+    last_count = current_count;             // Update position tracking
 
-    if (total_rotation >= 180){             // Player met rotation requirement
+    if (twisting && abs(current_count - twist_start) * 360 >= TWIST_DEGREES * 96) {
+        twisting = FALSE;                   // one report per twist
+        total_rotation = 0;
+        return 1;
+    }
+    if (total_rotation * 360 >= ROTATE_DEGREES * 96){  // Player met rotation requirement by turning slowly
         total_rotation = 0;                 // Reset rotation for next time
         return 1;
     }
@@ -178,58 +410,74 @@ int rotaryActivated(){
 int IMUActivated(){
     
     static sensor_t initial_face = none;
-    static int waiting_for_flip = 0;
+    static int      angle[3]     = {0};     // rotation integrated from the gyro per axis [millidegrees]
+    static uint32_t last_us      = 0;
+    static uint32_t next_frame   = 0;       // sequence number of the next frame to integrate
+    static uint32_t frame_us     = 0;       // timestamp of the last integrated frame
+
+    if (!BNO055_IsReady()) { return FALSE; }   // IMU still coming up
 
     sensor_t current_face = sensorFaceUp();
+    uint32_t now = TIMERS_GetMicroSeconds();
+    uint32_t dt  = now - last_us;
+    last_us = now;
 
           // printf("Initial face: %d, Current face: %d\n", initial_face, current_face);
 
-    // Store the initial face the first time IMUActivated() is called
-    if (initial_face == none && !waiting_for_flip) {
-        int AccX = (BNO055_ReadAccelX() - X_ACC_BIAS),
-            AccY = (BNO055_ReadAccelY() - Y_ACC_BIAS),            
-            AccZ = (BNO055_ReadAccelZ() - Z_ACC_BIAS);
-
-        int absX = abs(AccX), absY = abs(AccY), absZ = abs(AccZ);
-
-        if          ( absX > absY && absX > absZ ) { // check if X has greatest magnitude
-            if (AccX > 0)   { initial_face = rotary; }
-            else            { initial_face = piezo; }
-
-        } else if   ( absY > absX && absY > absZ ) { // check if Y has greatest magnitude
-            if (AccY > 0)   { initial_face = infrared; } 
-            else            { initial_face = ultrasonic; }
-
-        } else if   ( absZ > absX && absZ > absY ) { // check if Z has greatest magnitude
-            if (AccZ > 0)   { initial_face = flex; } 
-            else            { initial_face = captouch; }
-        }
-        waiting_for_flip = 1;
+    // Store the initial face when a trial starts, i.e. on the first call or after a gap between calls
+    if (initial_face == none || dt > 100000) {
+        initial_face = dominantFace(&acc);              // frame cached by sensorFaceUp() above
+        angle[0] = angle[1] = angle[2] = 0;
+        next_frame = IMU_Sequence();
+        frame_us = now;
             // printf("IMU: Initial face recorded as %d, waiting for flip\n", initial_face);
         return 0;
     }
-    
-    // Define the expected opposite faces and Check if flipped to opposite face
-    if (waiting_for_flip) {
-        int flipped = 0;
-        
-        switch (initial_face) {
-            case captouch:   flipped = (current_face == flex);       break;
-            case flex:       flipped = (current_face == captouch);   break;
-            case rotary:     flipped = (current_face == piezo);      break;
-            case piezo:      flipped = (current_face == rotary);     break;
-            case infrared:   flipped = (current_face == ultrasonic); break;
-            case ultrasonic: flipped = (current_face == infrared);   break;
-            default: break;}
-        
-        // Once flipped, reset initial_face and waiting_for_flip for next time and return success
-        if (flipped) {
-            printf("IMU: Flip detected! From %d to %d\n", initial_face, current_face);
-            initial_face = none;
-            waiting_for_flip = 0;
-            return 1;
+
+    // Gyro path: integrate angular rate and confirm once the rotation about the two horizontal axes passes
+    // FLIP_DEGREES while gravity shows the starting face turned past horizontal; a shake integrates back
+    // towards zero and never turns the face over, so it is rejected on both counts
+    int flipped = 0;
+    int axis = faceAxis(initial_face), up = faceComponent(&acc, initial_face);
+    imu_frame_t frame;
+    accel_t tilt;
+
+    // integrate every frame sampled since the last call, spaced by its own timestamp
+    for (; next_frame != IMU_Sequence(); next_frame++) {
+        if (IMU_Get(next_frame, &frame) != SUCCESS) { continue; }  // already overwritten
+
+        uint32_t step = frame.time - frame_us;
+        frame_us = frame.time;
+        if (step > 50000) { step = 50000; }             // bound a gap in sampling, keeps the product in 32 bits
+        for (int i = 0; i < 3; i++) { angle[i] += frame.gyro[i] * (int)step / 16000; }     // 16 LSB per dps
+
+        // still resting on the starting face: drop whatever gyro bias has accumulated
+        accelCalibrate(frame.accel, &tilt);
+        up = faceComponent(&tilt, initial_face);
+        if (up > 900 && abs(frame.gyro[0]) < 80 && abs(frame.gyro[1]) < 80 && abs(frame.gyro[2]) < 80) {
+            angle[0] = angle[1] = angle[2] = 0;
         }
     }
+
+    int a = angle[(axis + 1) % 3] / 1000, b = angle[(axis + 2) % 3] / 1000;     // [degrees]
+    flipped = (a * a + b * b >= FLIP_DEGREES * FLIP_DEGREES) && (up < -FLIP_CONFIRM_MG);
+
+    // Accelerometer path: the classifier has settled on the opposite face
+    switch (initial_face) {
+        case captouch:   flipped |= (current_face == flex);       break;
+        case flex:       flipped |= (current_face == captouch);   break;
+        case rotary:     flipped |= (current_face == piezo);      break;
+        case piezo:      flipped |= (current_face == rotary);     break;
+        case infrared:   flipped |= (current_face == ultrasonic); break;
+        case ultrasonic: flipped |= (current_face == infrared);   break;
+        default: break;}
+
+    // Once flipped, reset initial_face for next time and return success
+    if (flipped) {
+        printf("IMU: Flip detected! From %d, rotated (%d, %d, %d) mdeg\n", initial_face, angle[0], angle[1], angle[2]);
+        initial_face = none;
+        return 1;
+    }
     return 0;
 }
 
@@ -247,4 +495,69 @@ void GPIO_Init(){
     // HAL_NVIC_EnableIRQ(EXTI4_IRQn);
     // HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
     // HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
-}
\ No newline at end of file
+}
+
+
+//#define SENSORS_BENCHMARK
+#ifdef SENSORS_BENCHMARK
+// SUCCESS - prints the cycles per face classification for the former double precision bias correction
+//           and for the fixed point calibration plus orientation classifier; both are fed the same raw
+//           frames, no I2C involved
+
+#include <Board.h>
+
+static const int16_t frames[6][3] = {
+    { 1003,   12,   40 }, { -990,   -8,   33 }, {   21, 1011,  -17 },
+    {   -4, -985,   26 }, {   30,  -52, 1009 }, {   -9,  -41, -994 }
+};
+
+static int legacyFaceUp(const int16_t raw[3]) {     // copy of the classification before the fixed point stage
+    int AccX = (raw[0] - 4.75), AccY = (raw[1] - -47.5), AccZ = (raw[2] - -8.75);
+
+    if      (AccZ > 900)  {return flex;}
+    else if (AccZ < -900) {return captouch;}
+    else if (AccX > 900)  {return rotary;}
+    else if (AccX < -900) {return piezo;}
+    else if (AccY > 900)  {return infrared;}
+    else if (AccY < -900) {return ultrasonic;}
+    else return none;
+}
+
+static int fixedFaceUp(const int16_t raw[3]) {
+    static uint32_t now = 0;                        // simulated clock, each frame arrives 100 ms after the last
+    accel_t a;
+    a.x = ((raw[0] * (1 << ACC_BIAS_Q) - X_ACC_BIAS) * X_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+    a.y = ((raw[1] * (1 << ACC_BIAS_Q) - Y_ACC_BIAS) * Y_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+    a.z = ((raw[2] * (1 << ACC_BIAS_Q) - Z_ACC_BIAS) * Z_ACC_SCALE) >> (ACC_BIAS_Q + ACC_SCALE_Q);
+    return faceFromAccel(&a, now += 100);
+}
+
+int main(void) {
+    BOARD_Init();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;     // enable the cycle counter
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    const int rounds = 1000;
+    volatile int sink = 0;
+
+    uint32_t start = DWT->CYCCNT;
+    for (int n = 0; n < rounds; n++) { for (int f = 0; f < 6; f++) { sink += legacyFaceUp(frames[f]); } }
+    uint32_t legacy = DWT->CYCCNT - start;
+
+    start = DWT->CYCCNT;
+    for (int n = 0; n < rounds; n++) { for (int f = 0; f < 6; f++) { sink += fixedFaceUp(frames[f]); } }
+    uint32_t fixed = DWT->CYCCNT - start;
+
+    for (int f = 0; f < 6; f++) {
+        fixedFaceUp(frames[f]);                     // first sighting opens the dwell window
+        printf("frame %d: legacy face %d, fixed point face %d\r\n", f, legacyFaceUp(frames[f]), fixedFaceUp(frames[f]));
+    }
+    printf("cycles per classification: legacy %lu, fixed point %lu\r\n",
+        (unsigned long)(legacy / (rounds * 6)), (unsigned long)(fixed / (rounds * 6)));
+
+    while (TRUE);
+}
+
+#endif
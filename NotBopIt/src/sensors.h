@@ -10,22 +10,61 @@
 
  #define LONG_PRESS  1000    // milliseconds constituting a captouch long press
 
- #define X_ACC_BIAS 4.75
- #define X_ACC_SCALE 1.0047
- #define Y_ACC_BIAS -47.5
- #define Y_ACC_SCALE 0.994
- #define Z_ACC_BIAS -8.75
- #define Z_ACC_SCALE 1.0014
+ // 1 runs the BNO055 in IMUPLUS fusion mode: face and flip detection then use the chip's gravity
+ // vector and the calibration constants below are not applied
+ #define IMU_FUSION   0
+
+ // accelerometer calibration in fixed point: bias in quarter mg (Q2), scale in Q14
+ #define ACC_BIAS_Q   2
+ #define ACC_SCALE_Q  14
+ #define X_ACC_BIAS   19      //   4.75 mg
+ #define X_ACC_SCALE  16461   //   1.0047
+ #define Y_ACC_BIAS   -190    // -47.5  mg
+ #define Y_ACC_SCALE  16286   //   0.994
+ #define Z_ACC_BIAS   -35     //  -8.75 mg
+ #define Z_ACC_SCALE  16407   //   1.0014
+
+ // orientation classifier: a face is entered inside the enter cone, held until it leaves the wider
+ // exit cone, and only reported after it has been stable for the dwell time
+ #define FACE_ENTER_DEGREES  30      // max tilt from vertical to enter a face
+ #define FACE_EXIT_DEGREES   45      // max tilt from vertical to keep a face
+ #define FACE_DWELL_MS       50      // time a new face must hold before it is reported
+
+ // IMU flip: the gyro must integrate this much rotation about a horizontal axis while the
+ // accelerometer shows the starting face turned past horizontal
+ #define FLIP_DEGREES        120     // integrated rotation confirming a flip
+ #define FLIP_CONFIRM_MG     250     // how far below horizontal the starting face axis must point
+
+ // IMU calibration: with no offsets stored in flash, the chip's own calibration (fusion modes
+ // only) is polled this often; once gyro and accelerometer are fully calibrated it waits for
+ // sensorSaveCalibration(), since erasing the flash sector stalls the CPU for 1 to 2 s
+ #define CALIB_CHECK_MS      1000
+
+ // ultrasonic: a hand counts when the filtered distance is near, or when it is still in reach
+ // and approaching fast; the BNO055 die temperature corrects the speed of sound
+ #define ULTRASONIC_NEAR_MM          60      // hand over the sensor
+ #define ULTRASONIC_REACH_MM         200     // range in which an approach counts
+ #define ULTRASONIC_APPROACH_MM_S    400     // approach speed counting as a wave
+ #define TEMP_CHECK_MS               10000   // how often the temperature is refreshed
+
+ // rotary encoder: menu steps per detent; in the game a brisk twist counts after a short turn,
+ // a slow turn only after half a revolution
+ #define MENU_DETENT_EDGES   4       // 15 degrees, one detent
+ #define MENU_RESYNC_MS      100     // menu not polled this long: turning meanwhile is ignored
+ #define TWIST_DEG_S         360     // speed that makes a turn a twist
+ #define TWIST_DEGREES       30      // rotation completing a twist
+ #define ROTATE_DEGREES      180     // rotation completing a slow turn
 
  #define FLEX_PIN  ADC_0
  #define PIEZO_PIN ADC_1
- #define PING_PIN  GPIO_PIN_0
+ #define PING_PIN  GPIO_PIN_15  // echo on PA15 (TIM2_CH1)
  #define TOUCH_PIN GPIO_PIN_5
  #define IR_PIN    GPIO_PIN_12
 
 #include <Board.h>
 #include "QEI.h"
 #include "BNO055.h"
+#include "imu.h"
 #include "ADC.h"
 #include "PING.h"
 
@@ -41,6 +80,10 @@ typedef enum {
 
     } sensor_t;   // used to store selected trial sensor value
 
+typedef struct {
+    int x, y, z;  // calibrated acceleration [mg]
+    } accel_t;
+
 uint32_t timeResponse; // used to evaluate sensor response time in MICROseconds
     
 /**
@@ -49,6 +92,12 @@ uint32_t timeResponse; // used to evaluate sensor response time in MICROseconds
 */
 void SENSORS_Init();
 
+/**
+* @function    SENSORS_Service()
+* @brief       advance background sensor work (IMU bring-up and sampling), call every loop
+*/
+void SENSORS_Service();
+
 // user navigation //
 
 /**
@@ -87,18 +136,53 @@ int captouchHeld(int duration);
 */
 int sensorActivated();
 
+/**
+* @function    void sensorPingSchedule(int playing, int selected)
+* @brief       pings only during a round: boosted when ultrasonic is the selected sensor,
+*              at the normal rate while its face is up, otherwise off
+*/
+void sensorPingSchedule(int playing, int selected);
+
+/**
+* @function    sensorSaveCalibration()
+* @brief       writes a completed IMU calibration to flash, if one is waiting; the sector erase
+*              stalls everything (interrupts included) for 1 to 2 s, call only where the game idles
+* @return      TRUE if a calibration was written
+*/
+int sensorSaveCalibration();
+
 
 
 // user response interpretation //
 
 // determines which sensor is currently face up based on accelerometer reading
 
+/**
+* @function    int accelRead(accel_t *acc)
+* @brief       latest sampled accelerometer frame with bias and scale correction in integer math
+*              with IMU_FUSION the frame is the chip's fused gravity vector and needs no correction
+*/
+int accelRead(accel_t *acc);
+
 /**
 * @function    int sensorFaceUp()
 * @brief       return value of face up sensor, zero if none
+*              reads one accelerometer frame; the face only changes after it has held for FACE_DWELL_MS
 */
 int sensorFaceUp();
 
+/**
+* @function    int sensorFaceConfidence()
+* @brief       confidence of the reported face from 0 (at the exit cone) to 100 (perfectly vertical)
+*/
+int sensorFaceConfidence();
+
+/**
+* @function    void sensorFaceConfig(int enterDegrees, int exitDegrees, int dwellMs)
+* @brief       set the enter/exit cone angles (rounded to 5 degrees) and dwell time of the orientation classifier
+*/
+void sensorFaceConfig(int enterDegrees, int exitDegrees, int dwellMs);
+
 // each of these are flags that go high for a single cycle if user has interacted with the sensor correctly
 
 /**
@@ -115,7 +199,8 @@ int piezoActivated();
 
 /**
 * @function    int rotaryActivated()
-* @brief       if the encoder has been rotated correctly read high once
+* @brief       if the encoder has been rotated correctly read high once: a brisk twist of TWIST_DEGREES
+*              or ROTATE_DEGREES of slower turning
 */
 int rotaryActivated();
 
@@ -138,8 +223,9 @@ int captouchActivated();
 int infraredActivated();
 
 /**
-* @function    int infraredActivated()
-* @brief       if the IMU has been triggered correctly read high once
+* @function    int IMUActivated()
+* @brief       if the IMU has been flipped onto its opposite face read high once
+*              gyro rotation confirms the flip early, the accelerometer settling on the opposite face is the fallback
 */
 int IMUActivated();
 
@@ -149,4 +235,4 @@ int IMUActivated();
 */
 void GPIO_Init();
 
- #endif
\ No newline at end of file
+ #endif
@@ -2,20 +2,28 @@
 #include <timers.h>
 #include <pwm.h>
 
+#define SPEAKER         PWM_4   // PB6, TIM4 is the speaker's own timer, the RGB LED keeps TIM1
+#define TONE_MIN        100     // [Hz] PWM_SetTimerFrequency() range
+#define TONE_MAX        100000
+
 int frequency = 0;  // holds tone value, default (sound off) is zero 
 
 
-void SOUND_Init() { PWM_Init(); }
+void SOUND_Init() { PWM_Init(); PWM_SetDutyCycle(SPEAKER, 0); }    // speaker pin silent
 
+// called every game cycle with the same tone, the PWM calls return at once unless it changed
 void playTone(int tone) {       frequency = tone;
 
-    // add code to play tone
+    if (tone < TONE_MIN || tone > TONE_MAX) { soundOff(); return; }
+
+    PWM_SetTimerFrequency(SPEAKER.timer, tone);     // square wave at the tone's frequency
+    PWM_SetDutyCycle(SPEAKER, 50);
 
 }
 
 void soundOff() {               frequency = 0;
 
-    // add code to turn sound off
+    PWM_SetDutyCycle(SPEAKER, 0);
 
 }
 
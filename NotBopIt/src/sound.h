@@ -3,6 +3,10 @@
  * @brief   sound output library for the game NotBopIt
  * @author  Daniel Retta, Stephanie Scott, Danyang Hu
  * @date    January 23rd, 2025
+ *
+ * The speaker is wired to PB6 (TIM4_CH1, PWM_4 in pwm.h) and driven with a 50 % square wave. TIM4
+ * is retuned to each tone on its own, so the RGB LED on TIM1 keeps its carrier. PB8, the other
+ * TIM4 pin, is the PING trigger and stays with TIM10.
  * */
 
  #ifndef sound_H
@@ -16,7 +20,7 @@ void SOUND_Init();
 
  /**
  * @function    playTone(int frequency)
- * @brief       Play the provided tone out over the speaker.
+ * @brief       Play the provided tone out over the speaker (PWM_4 on PB6, TIM4), off below 100 Hz.
  */
 void playTone(int frequency);
 
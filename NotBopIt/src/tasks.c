@@ -0,0 +1,128 @@
+#include <tasks.h>
+#include <Board.h>
+#include <timers.h>
+
+// few tasks, so a linear scan for the next one beats keeping them ordered
+typedef struct {
+    task_function_t run;
+    uint32_t        release;    // [us] next time the task is due
+    uint32_t        release_by; // [us] earlier release asked for while the task ran
+    int             early;      // release_by is set
+    uint64_t        exec_sum;   // [us] over stats.runs
+    task_stats_t    stats;
+} task_t;
+
+static task_t tasks[TASKS_MAX];
+static int    count = 0;
+static task_t *running = NULL;  // its release is only known once it returns
+
+int TASKS_Add(const char *name, task_function_t run, uint32_t period, int priority) {
+
+    if (count == TASKS_MAX || run == NULL || period == 0) { return ERROR; }
+
+    task_t *t = &tasks[count];
+    t->run     = run;
+    t->release = TIMERS_GetMicroSeconds();
+    t->stats.name     = name;
+    t->stats.period   = period;
+    t->stats.priority = priority;
+    return count++;
+}
+
+int TASKS_Run() {
+
+    uint32_t now = TIMERS_GetMicroSeconds();
+    task_t  *next = NULL;
+
+    for (int i = 0; i < count; i++) {
+        task_t *t = &tasks[i];
+        if ((int32_t)(now - t->release) < 0) { continue; }
+        if (next == NULL || t->stats.priority < next->stats.priority
+            || (t->stats.priority == next->stats.priority && (int32_t)(t->release - next->release) < 0)) { next = t; }
+    }
+    if (next == NULL) { return FALSE; }
+
+    task_stats_t *s = &next->stats;
+    uint32_t start = TIMERS_GetMicroSeconds();
+    next->early = FALSE;
+    running = next;
+    next->run();
+    running = NULL;
+    uint32_t end = TIMERS_GetMicroSeconds();
+
+    s->runs++;
+    s->exec_last = end - start;
+    next->exec_sum += s->exec_last;
+    s->exec_avg = next->exec_sum / s->runs;
+    if (s->exec_last > s->exec_max)            { s->exec_max = s->exec_last; }
+    if (start - next->release > s->late_max)   { s->late_max = start - next->release; }
+
+    // keep the phase; a task still busy at its next release overran, one a whole period behind drops releases
+    next->release += s->period;
+    if ((int32_t)(end - next->release) >= 0) {
+        uint32_t behind = (end - next->release) / s->period;
+        s->overruns++;
+        s->skipped     += behind;
+        next->release  += behind * s->period;
+    }
+    if (next->early && (int32_t)(next->release_by - next->release) < 0) { next->release = next->release_by; }
+    return TRUE;
+}
+
+int TASKS_SetPeriod(int id, uint32_t period) {
+
+    if (id < 0 || id >= count || period == 0) { return ERROR; }
+
+    task_t  *t = &tasks[id];
+    uint32_t now = TIMERS_GetMicroSeconds();
+
+    t->stats.period = period;
+    if (t != running && (int32_t)(t->release - (now + period)) > 0) { t->release = now + period; }
+    return SUCCESS;
+}
+
+int TASKS_ReleaseBy(int id, uint32_t release) {
+
+    if (id < 0 || id >= count) { return ERROR; }
+
+    task_t *t = &tasks[id];
+
+    if (t == running) {
+        t->release_by = release;
+        t->early = TRUE;
+    } else if ((int32_t)(release - t->release) < 0) {
+        t->release = release;
+    }
+    return SUCCESS;
+}
+
+uint32_t TASKS_NextDeadline() {
+
+    uint32_t now = TIMERS_GetMicroSeconds();
+    uint32_t earliest = now + 0x7FFFFFFF;
+
+    for (int i = 0; i < count; i++) {
+        if ((int32_t)(tasks[i].release - now) < (int32_t)(earliest - now)) { earliest = tasks[i].release; }
+    }
+    return earliest;
+}
+
+int TASKS_Count() { return count; }
+
+int TASKS_GetStats(int id, task_stats_t *stats) {
+
+    if (id < 0 || id >= count) { return ERROR; }
+
+    *stats = tasks[id].stats;
+    return SUCCESS;
+}
+
+void TASKS_ResetStats() {
+
+    for (int i = 0; i < count; i++) {
+        task_stats_t *s = &tasks[i].stats;
+        s->runs = s->overruns = s->skipped = 0;
+        s->exec_last = s->exec_max = s->exec_avg = s->late_max = 0;
+        tasks[i].exec_sum = 0;
+    }
+}
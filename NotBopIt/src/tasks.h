@@ -0,0 +1,86 @@
+/**
+ * @file    tasks.h
+ * @brief   cooperative fixed-rate task scheduler for the game NotBopIt
+ * @author  Daniel Retta, Stephanie Scott, Danyang Hu
+ * @date    January 23rd, 2025
+ * */
+
+ #ifndef tasks_H
+ #define tasks_H
+
+ #include <stdint.h>
+
+ #define TASKS_MAX   8       // tasks registered at once
+
+ // runs to completion; a task never blocks waiting for something, it returns and runs again next period
+ typedef void (*task_function_t)(void);
+
+ // execution statistics of one task, see TASKS_GetStats()
+ typedef struct {
+     const char *name;
+     uint32_t period;       // [us]
+     int      priority;     // 0 runs first when several tasks are due
+     uint32_t runs;
+     uint32_t overruns;     // runs that finished after the task's next release
+     uint32_t skipped;      // releases dropped because the task was a whole period late
+     uint32_t exec_last;    // [us]
+     uint32_t exec_max;     // [us]
+     uint32_t exec_avg;     // [us]
+     uint32_t late_max;     // [us] longest wait from release to start
+ } task_stats_t;
+
+ /**
+ * @function    TASKS_Add(const char *name, task_function_t run, uint32_t period, int priority)
+ * @brief       registers a task released every period [us], first released right away
+ * @return      task id for TASKS_GetStats(), or ERROR when TASKS_MAX tasks are registered
+ */
+int TASKS_Add(const char *name, task_function_t run, uint32_t period, int priority);
+
+ /**
+ * @function    TASKS_Run()
+ * @brief       runs the due task with the best priority (earliest release among equals), call every loop
+ * @return      TRUE if a task ran, FALSE if none was due
+ */
+int TASKS_Run();
+
+ /**
+ * @function    TASKS_SetPeriod(int id, uint32_t period)
+ * @brief       changes the period [us] of a task; a shorter period also pulls in a release further out
+ * @return      SUCCESS or ERROR for an unknown id or a zero period
+ */
+int TASKS_SetPeriod(int id, uint32_t period);
+
+ /**
+ * @function    TASKS_ReleaseBy(int id, uint32_t release)
+ * @brief       brings the next release [us, TIMERS_GetMicroSeconds()] of a task forward, if it is earlier;
+ *              called from the task itself it applies to the release that follows this run
+ * @return      SUCCESS or ERROR for an unknown id
+ */
+int TASKS_ReleaseBy(int id, uint32_t release);
+
+ /**
+ * @function    TASKS_NextDeadline()
+ * @brief       earliest release [us, TIMERS_GetMicroSeconds()] of any task
+ */
+uint32_t TASKS_NextDeadline();
+
+ /**
+ * @function    TASKS_Count()
+ * @return      number of registered tasks, ids are 0 to TASKS_Count() - 1
+ */
+int TASKS_Count();
+
+ /**
+ * @function    TASKS_GetStats(int id, task_stats_t *stats)
+ * @brief       copies the statistics of a task
+ * @return      SUCCESS or ERROR for an unknown id
+ */
+int TASKS_GetStats(int id, task_stats_t *stats);
+
+ /**
+ * @function    TASKS_ResetStats()
+ * @brief       clears the statistics of every task
+ */
+void TASKS_ResetStats();
+
+#endif